@@ -0,0 +1,75 @@
+/*
+ * Barrier, latch and wait group test
+ *
+ * Three workers print a message before and after reaching a barrier, so that
+ * all the "before" messages are printed before any "after" message. The main
+ * thread waits for them with a wait group, after opening a latch that holds
+ * them back at the start. The program should output:
+ *
+ * main: go
+ * worker 0 before
+ * worker 1 before
+ * worker 2 before
+ * worker 2 after (last)
+ * worker 0 after
+ * worker 1 after
+ * main: all done
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <barrier.h>
+#include <uthread.h>
+
+#define WORKERS 3
+
+uthread_barrier_t barrier;
+uthread_latch_t latch;
+uthread_waitgroup_t wg;
+
+static void worker(void *arg)
+{
+	size_t id = (size_t)arg;
+
+	uthread_latch_wait(latch);
+	printf("worker %zu before\n", id);
+	if (uthread_barrier_wait(barrier) == 1)
+		printf("worker %zu after (last)\n", id);
+	else
+		printf("worker %zu after\n", id);
+	uthread_waitgroup_done(wg);
+}
+
+static void thread1(void *arg)
+{
+	size_t i;
+	(void)arg;
+
+	uthread_waitgroup_add(wg, WORKERS);
+	for (i = 0; i < WORKERS; i++)
+		uthread_create(worker, (void*)i);
+
+	/* Let the workers block on the latch before opening it */
+	uthread_yield();
+	printf("main: go\n");
+	uthread_latch_count_down(latch);
+
+	uthread_waitgroup_wait(wg);
+	printf("main: all done\n");
+}
+
+int main(void)
+{
+	barrier = uthread_barrier_create(WORKERS);
+	latch = uthread_latch_create(1);
+	wg = uthread_waitgroup_create();
+
+	uthread_run(false, thread1, NULL);
+
+	uthread_barrier_destroy(barrier);
+	uthread_latch_destroy(latch);
+	uthread_waitgroup_destroy(wg);
+
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * Future and continuation test
+ *
+ * A producer thread computes a value and sets a future, which a consumer
+ * thread is blocked on. Two continuations are chained after the future: an
+ * inline one, run by the producer when it sets the future, and a deferred one,
+ * spawned as a task and run later without its own thread. The program should
+ * output:
+ *
+ * producer: setting 21
+ * inline stage: 21 -> 42
+ * producer: done
+ * consumer: got 21
+ * deferred stage: 42 -> 43
+ * main: final value 43
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <future.h>
+#include <uthread.h>
+
+uthread_future_t request;
+
+static void *double_stage(void *value, void *arg)
+{
+	intptr_t v = (intptr_t)value;
+	(void)arg;
+
+	printf("inline stage: %ld -> %ld\n", (long)v, (long)v * 2);
+	return (void*)(v * 2);
+}
+
+static void *increment_stage(void *value, void *arg)
+{
+	intptr_t v = (intptr_t)value;
+	(void)arg;
+
+	printf("deferred stage: %ld -> %ld\n", (long)v, (long)v + 1);
+	return (void*)(v + 1);
+}
+
+static void producer(void *arg)
+{
+	(void)arg;
+
+	printf("producer: setting 21\n");
+	uthread_future_set(request, (void*)21);
+	printf("producer: done\n");
+}
+
+static void consumer(void *arg)
+{
+	void *value;
+	(void)arg;
+
+	uthread_future_get(request, &value);
+	printf("consumer: got %ld\n", (long)(intptr_t)value);
+}
+
+static void thread1(void *arg)
+{
+	uthread_future_t doubled, result;
+	void *value;
+	(void)arg;
+
+	doubled = uthread_future_then(request, double_stage, NULL,
+				      UTHREAD_THEN_INLINE);
+	result = uthread_future_then(doubled, increment_stage, NULL,
+				     UTHREAD_THEN_DEFERRED);
+
+	uthread_create(consumer, NULL);
+	uthread_create(producer, NULL);
+
+	uthread_future_get(result, &value);
+	printf("main: final value %ld\n", (long)(intptr_t)value);
+
+	uthread_future_destroy(doubled);
+	uthread_future_destroy(result);
+}
+
+int main(void)
+{
+	request = uthread_future_create();
+
+	uthread_run(false, thread1, NULL);
+
+	uthread_future_destroy(request);
+
+	return 0;
+}
@@ -262,6 +262,32 @@ void destroy_null_queue(void)
 	TEST_ASSERT(result == -1);
 }
 
+/* Remove items by handle, at the front, in the middle and at the rear */
+void test_remove_handle(void)
+{
+	queue_t q;
+	queue_handle_t handles[4];
+	int data[] = {1, 2, 3, 4};
+	int *ptr;
+
+	fprintf(stderr, "*** TEST remove_handle ***\n");
+
+	q = queue_create();
+	for (size_t i = 0; i < sizeof(data) / sizeof(data[0]); i++)
+	{
+		handles[i] = queue_enqueue_handle(q, &data[i]);
+	}
+
+	TEST_ASSERT(queue_remove_handle(q, handles[1]) == 0);
+	TEST_ASSERT(queue_remove_handle(q, handles[0]) == 0);
+	TEST_ASSERT(queue_remove_handle(q, handles[3]) == 0);
+	TEST_ASSERT(queue_length(q) == 1);
+	queue_dequeue(q, (void **)&ptr);
+	TEST_ASSERT(ptr == &data[2]);
+	TEST_ASSERT(queue_remove_handle(q, NULL) == -1);
+	TEST_ASSERT(queue_destroy(q) == 0);
+}
+
 int main(void)
 {
 	test_create();
@@ -277,6 +303,7 @@ int main(void)
 	delete_invalid_item();
 	destroy_nonempty_queue();
 	destroy_null_queue();
+	test_remove_handle();
 
 	return 0;
 }
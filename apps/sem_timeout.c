@@ -0,0 +1,77 @@
+/*
+ * Semaphore timeout test
+ *
+ * Three threads wait on the same semaphore with different timeouts. The first
+ * and the third give up, which takes them out of the middle and the end of the
+ * waiting list; the second one is still waiting when the semaphore is released
+ * and takes it. A final release is kept by the semaphore, as nobody waits
+ * anymore, and taken without waiting. The program should output:
+ *
+ * waiter 1: timed out after 10 ms
+ * waiter 3: timed out after 20 ms
+ * releaser: up
+ * waiter 2: got the semaphore
+ * releaser: up
+ * releaser: got the semaphore back
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define MS 1000000ULL
+
+static sem_t sem;
+
+struct waiter {
+	int id;
+	unsigned int timeout;
+};
+
+static void waiter(void *arg)
+{
+	struct waiter *w = (struct waiter*)arg;
+
+	if (sem_down_timeout(sem, w->timeout * MS))
+		printf("waiter %d: timed out after %u ms\n", w->id, w->timeout);
+	else
+		printf("waiter %d: got the semaphore\n", w->id);
+}
+
+static void releaser(void *arg)
+{
+	(void)arg;
+
+	/* Let the first and third waiters give up */
+	uthread_sleep(30 * MS);
+	printf("releaser: up\n");
+	sem_up(sem);
+	uthread_yield();
+
+	printf("releaser: up\n");
+	sem_up(sem);
+	if (sem_down_timeout(sem, 0) == 0)
+		printf("releaser: got the semaphore back\n");
+}
+
+static void start(void *arg)
+{
+	static struct waiter waiters[] = { { 1, 10 }, { 2, 1000 }, { 3, 20 } };
+	int i;
+	(void)arg;
+
+	for (i = 0; i < 3; i++)
+		uthread_create(waiter, &waiters[i]);
+	uthread_create(releaser, NULL);
+}
+
+int main(void)
+{
+	sem = sem_create(0);
+	uthread_run(false, start, NULL);
+	sem_destroy(sem);
+
+	return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * Arena allocator test
+ *
+ * Three threads serve requests with preemption enabled. Every request builds
+ * a linked list of a few hundred small nodes from the arena of its thread,
+ * checks that no other thread overwrote them, then releases the whole arena at
+ * once. A large allocation is also made in the middle of every request. The
+ * program should output:
+ *
+ * thread 1: 20000 requests, 0 corrupted
+ * thread 2: 20000 requests, 0 corrupted
+ * thread 3: 20000 requests, 0 corrupted
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <uthread.h>
+
+#define REQUESTS	20000
+#define NODES		300
+
+struct node {
+	int owner;
+	int value;
+	struct node *next;
+};
+
+static int serve(int id, int request)
+{
+	struct node *list = NULL, *node;
+	char *buffer;
+	int i, sum = 0;
+
+	for (i = 0; i < NODES; i++) {
+		node = uthread_arena_alloc(sizeof(struct node));
+		node->owner = id;
+		node->value = request + i;
+		node->next = list;
+		list = node;
+
+		if (i == NODES / 2) {
+			buffer = uthread_arena_alloc(UTHREAD_ARENA_CHUNK_SIZE);
+			memset(buffer, id, UTHREAD_ARENA_CHUNK_SIZE);
+		}
+	}
+
+	for (node = list; node; node = node->next)
+		if (node->owner == id)
+			sum += node->value;
+
+	/* End of the request, release everything at once */
+	uthread_arena_reset();
+	return sum != NODES * request + NODES * (NODES - 1) / 2;
+}
+
+/* Corrupted requests of every thread, printed once all are done */
+static int corrupted[3];
+
+static void thread(void *arg)
+{
+	int id = *(int*)arg;
+	int request;
+
+	for (request = 0; request < REQUESTS; request++)
+		corrupted[id - 1] += serve(id, request);
+}
+
+static void start(void *arg)
+{
+	static int ids[] = { 1, 2, 3 };
+	int i;
+	(void)arg;
+
+	for (i = 0; i < 3; i++)
+		uthread_create(thread, &ids[i]);
+}
+
+int main(void)
+{
+	int i;
+
+	uthread_run(true, start, NULL);
+	for (i = 0; i < 3; i++)
+		printf("thread %d: %d requests, %d corrupted\n", i + 1,
+		       REQUESTS, corrupted[i]);
+	return 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Thread attributes test
+ *
+ * Creates threads with different priorities, and one with a small stack
+ * provided by the caller. Higher priority threads run first, and threads of the
+ * same priority run in creation order. The program should output:
+ *
+ * high: priority 2
+ * small: 8 KiB stack
+ * main: priority 1
+ * low: priority 0
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <uthread.h>
+
+static char small_stack[UTHREAD_STACK_MIN];
+
+static void named(void *arg)
+{
+	printf("%s: priority %d\n", uthread_get_name(NULL), *(int*)arg);
+}
+
+static void small(void *arg)
+{
+	(void)arg;
+
+	printf("%s: %zu KiB stack\n", uthread_get_name(uthread_self()),
+	       sizeof(small_stack) / 1024);
+}
+
+static void thread1(void *arg)
+{
+	static int prio_low = UTHREAD_PRIO_LOW, prio_high = UTHREAD_PRIO_HIGH;
+	static int prio_normal = UTHREAD_PRIO_NORMAL;
+	uthread_attr_t attr;
+	(void)arg;
+
+	uthread_attr_init(&attr);
+	attr.priority = UTHREAD_PRIO_LOW;
+	attr.name = "low";
+	uthread_create_attr(NULL, &attr, named, &prio_low);
+
+	uthread_attr_init(&attr);
+	attr.priority = UTHREAD_PRIO_HIGH;
+	attr.name = "high";
+	uthread_create_attr(NULL, &attr, named, &prio_high);
+
+	uthread_attr_init(&attr);
+	attr.stack_addr = small_stack;
+	attr.stack_size = sizeof(small_stack);
+	attr.name = "small";
+	uthread_create_attr(NULL, &attr, small, NULL);
+
+	uthread_yield();
+	printf("main: priority %d\n", prio_normal);
+}
+
+int main(void)
+{
+	uthread_run(false, thread1, NULL);
+
+	return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * Huge page stack test
+ *
+ * Checks that uthread_set_stack_mode() rejects stacks too large for a huge
+ * page, then creates 200 threads with 16 KiB stacks carved from 2 MiB arenas.
+ * Every thread fills a buffer on its stack with its number, yields a few
+ * times so that all the others run on their own stacks, and checks that its
+ * buffer survived. The stacks of the threads should fit in two arenas. On a
+ * system without huge pages, it only reports that the mode is unavailable. The
+ * program should output:
+ *
+ * 4 MiB stacks: rejected
+ * 200 threads, stacks intact: yes, arenas used: 2
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <uthread.h>
+
+#define THREADS		200
+#define STACK_SIZE	(16 * 1024)
+#define ARENA_SIZE	(2 * 1024 * 1024)
+#define YIELDS		5
+
+/* Arena of the stack of every thread, and whether the stack survived */
+static uintptr_t arenas[THREADS];
+static int intact[THREADS];
+
+static void thread(void *arg)
+{
+	int id = (int)(intptr_t)arg;
+	volatile char buffer[4096];
+	int i;
+
+	memset((char*)buffer, id, sizeof(buffer));
+	arenas[id] = (uintptr_t)buffer / ARENA_SIZE;
+
+	for (i = 0; i < YIELDS; i++)
+		uthread_yield();
+
+	intact[id] = 1;
+	for (i = 0; i < (int)sizeof(buffer); i++)
+		if (buffer[i] != (char)id)
+			intact[id] = 0;
+}
+
+static void start(void *arg)
+{
+	int i;
+	(void)arg;
+
+	for (i = 0; i < THREADS; i++)
+		uthread_create(thread, (void*)(intptr_t)i);
+}
+
+int main(void)
+{
+	int i, j, used = 0, ok = 1;
+
+	printf("4 MiB stacks: %s\n",
+	       uthread_set_stack_mode(UTHREAD_STACK_HUGE, 2 * ARENA_SIZE) ?
+	       "rejected" : "accepted");
+
+	if (uthread_set_stack_mode(UTHREAD_STACK_HUGE, STACK_SIZE)) {
+		printf("huge pages unavailable\n");
+		return 0;
+	}
+	uthread_run(false, start, NULL);
+
+	/* Count the distinct arenas */
+	for (i = 0; i < THREADS; i++) {
+		ok &= intact[i];
+		for (j = 0; j < i && arenas[j] != arenas[i]; j++)
+			continue;
+		used += j == i;
+	}
+	printf("%d threads, stacks intact: %s, arenas used: %d\n", THREADS,
+	       ok ? "yes" : "no", used);
+	return 0;
+}
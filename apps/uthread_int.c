@@ -0,0 +1,111 @@
+/*
+ * Integer-only threads test
+ *
+ * Two integer-only threads and a floating point thread run with preemption
+ * enabled, yielding to each other in every order. The floating point thread
+ * rounds upwards, and checks that its rounding mode and its results survive
+ * the switches from and to the integer-only threads. The integer-only threads
+ * check that their values survive the switches too, then spin until preempted
+ * a few times, checking that neither the preemption nor the profiling signal
+ * stays blocked after switching from another preempted integer-only thread.
+ * The program should output:
+ *
+ * integer thread 1: sum 1250025000, 0 errors
+ * integer thread 2: sum 1250025000, 0 errors
+ * fp thread: 50000 divisions rounded upwards, 0 errors
+ */
+
+#include <fenv.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <uthread.h>
+
+#define ROUNDS	50000
+#define PREEMPTIONS	5
+
+static long sums[2];
+static int errors[3];
+
+static void integer(void *arg)
+{
+	int id = *(int*)arg;
+	long a = id, b = 2 * id, c = 3 * id;
+	long i, sum = 0;
+	uthread_thread_stats_t stats;
+	uint64_t preemptions;
+	sigset_t mask;
+
+	for (i = 1; i <= ROUNDS; i++) {
+		sum += i;
+		a += b;
+		b += c;
+		c += id;
+		if (i % 7 == 0)
+			uthread_yield();
+		if (a % id || b % id || c % id)
+			errors[id - 1]++;
+	}
+	sums[id - 1] = sum;
+
+	uthread_get_thread_stats(uthread_self(), &stats);
+	preemptions = stats.involuntary_switches + PREEMPTIONS;
+	do {
+		sigprocmask(SIG_BLOCK, NULL, &mask);
+		if (sigismember(&mask, SIGVTALRM) || sigismember(&mask, SIGPROF)) {
+			errors[id - 1]++;
+			break;
+		}
+		uthread_get_thread_stats(uthread_self(), &stats);
+	} while (stats.involuntary_switches < preemptions);
+}
+
+static void fp(void *arg)
+{
+	volatile double one = 1.0, three = 3.0;
+	double down;
+	int i;
+	(void)arg;
+
+	/* Rounding downwards then upwards must differ in the last bit */
+	fesetround(FE_DOWNWARD);
+	down = one / three;
+	fesetround(FE_UPWARD);
+
+	for (i = 0; i < ROUNDS; i++) {
+		if (i % 5 == 0)
+			uthread_yield();
+		if (fegetround() != FE_UPWARD || one / three <= down)
+			errors[2]++;
+	}
+	fesetround(FE_TONEAREST);
+}
+
+static void start(void *arg)
+{
+	static int ids[] = { 1, 2 };
+	uthread_attr_t attr;
+	int i;
+	(void)arg;
+
+	uthread_attr_init(&attr);
+	attr.integer_only = true;
+	for (i = 0; i < 2; i++)
+		uthread_create_attr(NULL, &attr, integer, &ids[i]);
+	uthread_create(fp, NULL);
+}
+
+int main(void)
+{
+	int i;
+
+	uthread_run(true, start, NULL);
+	for (i = 0; i < 2; i++)
+		printf("integer thread %d: sum %ld, %d errors\n", i + 1,
+		       sums[i], errors[i]);
+	printf("fp thread: %d divisions rounded upwards, %d errors\n",
+	       ROUNDS, errors[2]);
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Sampling profiler test
+ *
+ * Two named threads keep the processor busy in turn, with preemption enabled,
+ * while the profiler samples them. The folded stacks are then read back to
+ * check that both threads were sampled in their busy function, which is named
+ * because the program is linked with `-rdynamic`. The profile is taken again
+ * at a rate faster than the timer can go, which is clamped rather than
+ * disarming the timer. The program should output:
+ *
+ * profile at 997 Hz: samples taken: yes
+ * spin_a: sampled in burn: yes
+ * spin_b: sampled in burn: yes
+ * profile at 2000000 Hz: samples taken: yes
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <profile.h>
+#include <uthread.h>
+
+#define BUSY_NS 200000000
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Not static, so that the dynamic symbol table names it */
+__attribute__((noinline)) void burn(uint64_t ns)
+{
+	uint64_t end = now_ns() + ns;
+
+	while (now_ns() < end)
+		continue;
+}
+
+static void spinner(void *arg)
+{
+	(void)arg;
+	burn(BUSY_NS);
+}
+
+static void start(void *arg)
+{
+	static const char *names[] = { "spin_a", "spin_b" };
+	uthread_attr_t attr;
+	int i;
+	(void)arg;
+
+	for (i = 0; i < 2; i++) {
+		uthread_attr_init(&attr);
+		attr.name = names[i];
+		uthread_create_attr(NULL, &attr, spinner, NULL);
+	}
+}
+
+/* Whether a folded stack of thread @name goes through function burn() */
+static bool sampled_in_burn(const char *path, const char *name)
+{
+	FILE *f = fopen(path, "r");
+	char line[4096];
+	bool found = false;
+
+	if (!f)
+		return false;
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, name, strlen(name)) &&
+		    line[strlen(name)] == '#' && strstr(line, ";burn"))
+			found = true;
+	fclose(f);
+	return found;
+}
+
+/* Profile the spinners at @hz, return the number of samples */
+static int profile(unsigned int hz, const char *path)
+{
+	uthread_profile_start(hz);
+	uthread_run(true, start, NULL);
+	uthread_profile_stop();
+	return uthread_profile_dump(path);
+}
+
+int main(void)
+{
+	char path[] = "/tmp/uthread_profile.XXXXXX";
+	int fd = mkstemp(path);
+
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+
+	printf("profile at %d Hz: samples taken: %s\n", UTHREAD_PROFILE_HZ,
+	       profile(0, path) > 0 ? "yes" : "no");
+	printf("spin_a: sampled in burn: %s\n",
+	       sampled_in_burn(path, "spin_a") ? "yes" : "no");
+	printf("spin_b: sampled in burn: %s\n",
+	       sampled_in_burn(path, "spin_b") ? "yes" : "no");
+
+	printf("profile at 2000000 Hz: samples taken: %s\n",
+	       profile(2000000, path) > 0 ? "yes" : "no");
+
+	unlink(path);
+	return 0;
+}
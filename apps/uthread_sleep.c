@@ -0,0 +1,117 @@
+/*
+ * Blocking idle thread test
+ *
+ * Three threads sleep for different durations and wake up in order of their
+ * deadline. A fourth thread waits for a pipe which a fifth thread writes to
+ * after sleeping, and a kernel thread submits a function while the main
+ * thread holds uthread_run(). No thread is ready for most of the run, so the
+ * worker sleeps in the kernel instead of spinning.
+ *
+ * A second run blocks a thread on a semaphore that is never released, which
+ * is reported as a deadlock. The program should output:
+ *
+ * sleeper 1: woke up after 10 ms
+ * sleeper 2: woke up after 20 ms
+ * sleeper 3: woke up after 30 ms
+ * reader: got 'x'
+ * submitted: hello from a kernel thread
+ * uthread: deadlock, 1 thread(s) blocked forever
+ * deadlock run: -1
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <poll.h>
+#include <sem.h>
+#include <uthread.h>
+
+#define MS 1000000ULL
+
+static int fds[2];
+
+static void sleeper(void *arg)
+{
+	int i = *(int*)arg;
+
+	uthread_sleep(i * 10 * MS);
+	printf("sleeper %d: woke up after %d ms\n", i, i * 10);
+}
+
+static void reader(void *arg)
+{
+	char c;
+	(void)arg;
+
+	uthread_wait_fd(fds[0], POLLIN);
+	if (read(fds[0], &c, 1) == 1)
+		printf("reader: got '%c'\n", c);
+}
+
+static void writer(void *arg)
+{
+	(void)arg;
+
+	uthread_sleep(40 * MS);
+	if (write(fds[1], "x", 1) != 1)
+		perror("write");
+}
+
+static void submitted(void *arg)
+{
+	printf("submitted: %s\n", (char*)arg);
+}
+
+static void *kernel_thread(void *arg)
+{
+	struct timespec ts = { 0, 50 * MS };
+	(void)arg;
+
+	nanosleep(&ts, NULL);
+	uthread_submit(submitted, "hello from a kernel thread");
+	uthread_release();
+	return NULL;
+}
+
+static void start(void *arg)
+{
+	static int index[] = { 3, 1, 2 };
+	int i;
+	(void)arg;
+
+	for (i = 0; i < 3; i++)
+		uthread_create(sleeper, &index[i]);
+	uthread_create(reader, NULL);
+	uthread_create(writer, NULL);
+}
+
+static void stuck(void *arg)
+{
+	sem_t sem = sem_create(0);
+	(void)arg;
+
+	sem_down(sem);
+}
+
+int main(void)
+{
+	pthread_t thread;
+
+	if (pipe(fds)) {
+		perror("pipe");
+		return 1;
+	}
+
+	/* Keep uthread_run() waiting for the submission */
+	uthread_hold();
+	pthread_create(&thread, NULL, kernel_thread, NULL);
+	uthread_run(false, start, NULL);
+	pthread_join(thread, NULL);
+
+	fflush(stdout);
+	printf("deadlock run: %d\n", uthread_run(false, stuck, NULL));
+	return 0;
+}
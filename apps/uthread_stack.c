@@ -0,0 +1,119 @@
+/*
+ * Stack release test
+ *
+ * Three threads with lazily committed stacks go through a burst of deep calls,
+ * then park on a semaphore with most of their stack unused but still resident.
+ * A reporter thread reads their stack statistics, gives the unused pages back
+ * with uthread_stack_release(), and wakes them up. The threads check that the
+ * part of their stack in use survived, and go deep again. The program should
+ * output:
+ *
+ * thread 1: high water over 192 KiB: yes, released over 160 KiB: yes, resident under 32 KiB: yes
+ * thread 2: high water over 192 KiB: yes, released over 160 KiB: yes, resident under 32 KiB: yes
+ * thread 3: high water over 192 KiB: yes, released over 160 KiB: yes, resident under 32 KiB: yes
+ * thread 1: stack intact: yes
+ * thread 2: stack intact: yes
+ * thread 3: stack intact: yes
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define THREADS		3
+#define STACK_KIB	512
+#define DEPTH_KIB	192
+
+static sem_t park;
+static uthread_t threads[THREADS];
+
+/* Whether the stack of every thread survived, printed once all are done */
+static int intact[THREADS];
+
+/* Use about 1 KiB of stack per level */
+static size_t recurse(size_t depth)
+{
+	volatile char frame[1024];
+
+	memset((char*)frame, (int)depth, sizeof(frame));
+	if (depth == 0)
+		return frame[0];
+	return recurse(depth - 1) + frame[depth % sizeof(frame)];
+}
+
+static const char *yes(int cond)
+{
+	return cond ? "yes" : "no";
+}
+
+static void worker(void *arg)
+{
+	int id = *(int*)arg;
+	int keep[256];
+	size_t burst;
+	int i;
+
+	for (i = 0; i < 256; i++)
+		keep[i] = id * i;
+
+	burst = recurse(DEPTH_KIB);
+	sem_down(park);
+
+	intact[id - 1] = recurse(DEPTH_KIB) == burst;
+	for (i = 0; i < 256; i++)
+		if (keep[i] != id * i)
+			intact[id - 1] = 0;
+}
+
+static void reporter(void *arg)
+{
+	uthread_stack_stats_t before[THREADS], after[THREADS];
+	int i;
+	(void)arg;
+
+	for (i = 0; i < THREADS; i++)
+		uthread_get_stack_stats(threads[i], &before[i]);
+	uthread_stack_release(0);
+	for (i = 0; i < THREADS; i++)
+		uthread_get_stack_stats(threads[i], &after[i]);
+
+	for (i = 0; i < THREADS; i++)
+		printf("thread %d: high water over %d KiB: %s, "
+		       "released over %d KiB: %s, resident under 32 KiB: %s\n",
+		       i + 1, DEPTH_KIB,
+		       yes(before[i].high_water > DEPTH_KIB * 1024), 160,
+		       yes(after[i].released > 160 * 1024 &&
+			   before[i].resident - after[i].resident == after[i].released),
+		       yes(after[i].resident < 32 * 1024));
+
+	for (i = 0; i < THREADS; i++)
+		sem_up(park);
+}
+
+static void start(void *arg)
+{
+	static int ids[] = { 1, 2, 3 };
+	int i;
+	(void)arg;
+
+	for (i = 0; i < THREADS; i++)
+		uthread_create_attr(&threads[i], NULL, worker, &ids[i]);
+	uthread_create(reporter, NULL);
+}
+
+int main(void)
+{
+	int i;
+
+	park = sem_create(0);
+	uthread_set_stack_mode(UTHREAD_STACK_LAZY, STACK_KIB * 1024);
+	uthread_run(false, start, NULL);
+	sem_destroy(park);
+
+	for (i = 0; i < THREADS; i++)
+		printf("thread %d: stack intact: %s\n", i + 1, yes(intact[i]));
+	return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * Thread statistics test
+ *
+ * The main thread creates a thread that waits on a semaphore, then keeps the
+ * processor for 20 ms before releasing it. Both threads check their own
+ * statistics, and the scheduler totals are printed once all threads are done.
+ * The program should output:
+ *
+ * main: ran for at least 20 ms, 1 voluntary switch(es)
+ * waiter: waited for at least 20 ms, 1 voluntary switch(es)
+ * threads: 2 created, 2 exited
+ * context switches: 6
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define BUSY_NS 20000000
+
+static sem_t sem;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void waiter(void *arg)
+{
+	uthread_thread_stats_t stats;
+	(void)arg;
+
+	sem_down(sem);
+
+	uthread_get_thread_stats(NULL, &stats);
+	if (stats.sem_wait_ns >= BUSY_NS && stats.blocked_ns >= BUSY_NS)
+		printf("waiter: waited for at least %d ms, %lu voluntary switch(es)\n",
+		       BUSY_NS / 1000000,
+		       (unsigned long)stats.voluntary_switches);
+}
+
+static void thread1(void *arg)
+{
+	uthread_thread_stats_t stats;
+	uint64_t start;
+	(void)arg;
+
+	uthread_create(waiter, NULL);
+
+	/* Let the waiter block on the semaphore */
+	uthread_yield();
+
+	start = now_ns();
+	while (now_ns() - start < BUSY_NS)
+		;
+	sem_up(sem);
+
+	uthread_get_thread_stats(NULL, &stats);
+	if (stats.cpu_ns >= BUSY_NS)
+		printf("main: ran for at least %d ms, %lu voluntary switch(es)\n",
+		       BUSY_NS / 1000000,
+		       (unsigned long)stats.voluntary_switches);
+
+	uthread_yield();
+}
+
+int main(void)
+{
+	uthread_stats_t stats;
+
+	sem = sem_create(0);
+	uthread_run(false, thread1, NULL);
+	sem_destroy(sem);
+
+	uthread_stats(&stats);
+	printf("threads: %lu created, %lu exited\n",
+	       (unsigned long)stats.threads_created,
+	       (unsigned long)stats.threads_exited);
+	printf("context switches: %lu\n", (unsigned long)stats.context_switches);
+
+	return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * Thread-local storage test
+ *
+ * Two threads set their own value for a key stored in the TCB and for a key
+ * stored in the overflow table, then yield to each other and check that they
+ * still see their own values. The destructor of the first key runs when each
+ * thread exits. The program should output:
+ *
+ * thread1: context 1, overflow 10
+ * thread2: context 2, overflow 20
+ * thread1: destroying context 1
+ * thread2: destroying context 2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <uthread.h>
+
+static uthread_key_t context_key;
+static uthread_key_t overflow_key;
+
+static int contexts[] = { 1, 2 };
+static int overflows[] = { 10, 20 };
+
+static void context_destroy(void *value)
+{
+	printf("%s: destroying context %d\n", uthread_get_name(NULL),
+	       *(int*)value);
+}
+
+static void thread(void *arg)
+{
+	int i = *(int*)arg;
+
+	uthread_setspecific(context_key, &contexts[i]);
+	uthread_setspecific(overflow_key, &overflows[i]);
+
+	/* Let the other thread set its values */
+	uthread_yield();
+
+	printf("%s: context %d, overflow %d\n", uthread_get_name(NULL),
+	       *(int*)uthread_getspecific(context_key),
+	       *(int*)uthread_getspecific(overflow_key));
+
+	/* Let the other thread print before exiting */
+	uthread_yield();
+}
+
+static void start(void *arg)
+{
+	static int index[] = { 0, 1 };
+	uthread_attr_t attr;
+	uthread_key_t key;
+	int i;
+	(void)arg;
+
+	uthread_key_create(&context_key, context_destroy);
+
+	/* Use up the keys stored in the TCB */
+	for (i = 1; i < UTHREAD_KEYS_INLINE; i++)
+		uthread_key_create(&key, NULL);
+	uthread_key_create(&overflow_key, NULL);
+
+	uthread_attr_init(&attr);
+	attr.name = "thread1";
+	uthread_create_attr(NULL, &attr, thread, &index[0]);
+	attr.name = "thread2";
+	uthread_create_attr(NULL, &attr, thread, &index[1]);
+}
+
+int main(void)
+{
+	uthread_run(false, start, NULL);
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * Scheduler trace test
+ *
+ * Two named threads play ping-pong three times over a pair of semaphores, then
+ * the scheduler trace is written and read back to count the events of each
+ * kind. With the library built with `make TRACE=1`, the program should output:
+ *
+ * ping: 3 rounds
+ * trace written: yes
+ * tracks named ping and pong: yes
+ * block events: 5
+ * unblock events: 5
+ * exit events: 3
+ *
+ * Otherwise, tracing is not built in and the last lines are replaced by:
+ *
+ * trace written: no (build with make TRACE=1)
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define ROUNDS 3
+
+static sem_t ping_sem, pong_sem;
+
+static void ping(void *arg)
+{
+	int i;
+	(void)arg;
+
+	for (i = 0; i < ROUNDS; i++) {
+		sem_up(pong_sem);
+		sem_down(ping_sem);
+	}
+	printf("ping: %d rounds\n", ROUNDS);
+}
+
+static void pong(void *arg)
+{
+	int i;
+	(void)arg;
+
+	for (i = 0; i < ROUNDS; i++) {
+		sem_down(pong_sem);
+		sem_up(ping_sem);
+	}
+}
+
+static void start(void *arg)
+{
+	uthread_attr_t attr;
+	(void)arg;
+
+	uthread_attr_init(&attr);
+	attr.name = "ping";
+	uthread_create_attr(NULL, &attr, ping, NULL);
+	attr.name = "pong";
+	uthread_create_attr(NULL, &attr, pong, NULL);
+}
+
+/* Number of occurrences of @pattern in the file at @path */
+static int count(const char *path, const char *pattern)
+{
+	FILE *f = fopen(path, "r");
+	char line[512];
+	int n = 0;
+
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (strstr(line, pattern))
+			n++;
+	fclose(f);
+	return n;
+}
+
+int main(void)
+{
+	char path[] = "/tmp/uthread_trace.XXXXXX";
+	int fd = mkstemp(path);
+
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+
+	ping_sem = sem_create(0);
+	pong_sem = sem_create(0);
+	uthread_run(false, start, NULL);
+	sem_destroy(ping_sem);
+	sem_destroy(pong_sem);
+
+	if (uthread_trace_dump(path)) {
+		printf("trace written: no (build with make TRACE=1)\n");
+		unlink(path);
+		return 0;
+	}
+
+	printf("trace written: yes\n");
+	printf("tracks named ping and pong: %s\n",
+	       count(path, "\"name\":\"ping#") == 1 &&
+	       count(path, "\"name\":\"pong#") == 1 ? "yes" : "no");
+	printf("block events: %d\n", count(path, "\"name\":\"block\""));
+	printf("unblock events: %d\n", count(path, "\"name\":\"unblock\""));
+	printf("exit events: %d\n", count(path, "\"name\":\"exit\""));
+
+	unlink(path);
+	return 0;
+}
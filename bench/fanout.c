@@ -0,0 +1,169 @@
+/*
+ * Fan-out/fan-in latency benchmark
+ *
+ * A parent thread spawns N children which all park on a gate. The parent then
+ * opens the gate and waits for every child to signal its completion. Two
+ * timings are reported for each N:
+ * - release: time spent by the parent opening the gate
+ * - round trip: time from opening the gate until the parent is resumed after
+ *   the last child is done
+ *
+ * This is measured with plain semaphores (one sem_up() per child to open the
+ * gate and one sem_down() per child to collect them) and with the batch
+ * primitives (a latch for the gate and a wait group for completion), from 10
+ * children up to 100K (or the maximum given on the command line).
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <barrier.h>
+#include <sem.h>
+#include <uthread.h>
+
+#define MAXCHILDREN	100000
+#define MAXREPS		10
+
+struct fanout {
+	size_t children;
+	sem_t sem_gate;
+	sem_t sem_done;
+	uthread_latch_t latch_gate;
+	uthread_waitgroup_t wg_done;
+	double release_ns;
+	double roundtrip_ns;
+};
+
+static unsigned int max = MAXCHILDREN;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void sem_child(void *arg)
+{
+	struct fanout *f = (struct fanout*)arg;
+
+	sem_down(f->sem_gate);
+	sem_up(f->sem_done);
+}
+
+static void sem_parent(void *arg)
+{
+	struct fanout *f = (struct fanout*)arg;
+	double start, released;
+	size_t i;
+
+	for (i = 0; i < f->children; i++)
+		uthread_create(sem_child, f);
+
+	/* Let all the children park on the gate */
+	uthread_yield();
+
+	start = now_ns();
+	for (i = 0; i < f->children; i++)
+		sem_up(f->sem_gate);
+	released = now_ns();
+	for (i = 0; i < f->children; i++)
+		sem_down(f->sem_done);
+
+	f->release_ns += released - start;
+	f->roundtrip_ns += now_ns() - start;
+}
+
+static void batch_child(void *arg)
+{
+	struct fanout *f = (struct fanout*)arg;
+
+	uthread_latch_wait(f->latch_gate);
+	uthread_waitgroup_done(f->wg_done);
+}
+
+static void batch_parent(void *arg)
+{
+	struct fanout *f = (struct fanout*)arg;
+	double start, released;
+	size_t i;
+
+	uthread_waitgroup_add(f->wg_done, f->children);
+	for (i = 0; i < f->children; i++)
+		uthread_create(batch_child, f);
+
+	/* Let all the children park on the gate */
+	uthread_yield();
+
+	start = now_ns();
+	uthread_latch_count_down(f->latch_gate);
+	released = now_ns();
+	uthread_waitgroup_wait(f->wg_done);
+
+	f->release_ns += released - start;
+	f->roundtrip_ns += now_ns() - start;
+}
+
+static void run(const char *name, uthread_func_t parent, size_t children)
+{
+	struct fanout f;
+	size_t reps = MAXCHILDREN / children;
+	size_t i;
+
+	if (reps < 1)
+		reps = 1;
+	if (reps > MAXREPS)
+		reps = MAXREPS;
+
+	f.children = children;
+	f.release_ns = f.roundtrip_ns = 0;
+
+	for (i = 0; i < reps; i++) {
+		f.sem_gate = sem_create(0);
+		f.sem_done = sem_create(0);
+		f.latch_gate = uthread_latch_create(1);
+		f.wg_done = uthread_waitgroup_create();
+
+		uthread_run(false, parent, &f);
+
+		sem_destroy(f.sem_gate);
+		sem_destroy(f.sem_done);
+		uthread_latch_destroy(f.latch_gate);
+		uthread_waitgroup_destroy(f.wg_done);
+	}
+
+	printf("%-6s %8zu %14.1f %14.1f %12.1f\n", name, children,
+	       f.release_ns / reps / 1000, f.roundtrip_ns / reps / 1000,
+	       f.roundtrip_ns / reps / children);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	size_t children;
+
+	if (argc > 1)
+		max = get_argv(argv[1]);
+
+	printf("%-6s %8s %14s %14s %12s\n", "prim", "children",
+	       "release (us)", "roundtrip (us)", "ns/child");
+	for (children = 10; children <= max; children *= 10) {
+		run("sem", sem_parent, children);
+		run("batch", batch_parent, children);
+	}
+
+	return 0;
+}
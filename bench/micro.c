@@ -0,0 +1,765 @@
+/*
+ * Microbenchmark suite
+ *
+ * Measures the basic operations of the library, and compares them with raw
+ * swapcontext() and with pthreads where applicable:
+ * - yield: context switch latency between two threads yielding to each other,
+ *   per switch (uthread, uthread int with integer-only threads, swapcontext)
+ * - create: create and exit throughput, per thread (uthread, uthread batch with
+ *   uthread_create_batch(), pthread)
+ * - pingpong: semaphore ping-pong between two threads, per round trip
+ *   (uthread semaphores, pthread mutex and condition variable)
+ * - handoff: request/response round trip between two threads with 1000
+ *   background threads ready to run, handing over with uthread_yield(), which
+ *   runs all the background threads in between, or with uthread_yield_to()
+ * - queue: enqueue or dequeue operation on a queue of the library
+ * - alloc: small allocation, freed at the end of every batch (malloc and free,
+ *   uthread_arena_alloc() and uthread_arena_reset())
+ * - preempt: two threads sharing a fixed amount of work, per run, without and
+ *   with preemption; the difference is the preemption overhead
+ *
+ * Every benchmark times a number of samples, each of a batch of operations,
+ * and reports the percentiles of the time per operation over the samples.
+ * With --json, results are written as JSON on the standard output, to be
+ * compared between runs.
+ *
+ * With --perf, hardware counters (cycles, instructions, L1 data and last level
+ * cache misses, branch misses, data TLB misses) are also measured around the
+ * timed loops of every benchmark and reported per operation. The yield and
+ * queue benchmarks isolate the scheduler's switch path and the queue
+ * operations it relies on. Counters that the machine does not provide are
+ * reported as unavailable. Only the main thread is counted, which leaves out
+ * the partner thread of the pthread ping-pong and the threads of the pthread
+ * create benchmark.
+ *
+ * Usage: micro.x [--json] [--perf] [samples]
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+
+#include <queue.h>
+#include <sem.h>
+#include <uthread.h>
+
+#include "perf.h"
+
+#define SAMPLES		1000
+#define BATCH		100
+#define STACK_SIZE	32768
+
+/* Background threads of the handoff benchmark, and round trips per sample */
+#define HANDOFF_THREADS	1000
+#define HANDOFF_BATCH	10
+
+/* Work shared by the two threads of the preempt benchmark, per run */
+#define PREEMPT_RUNS	20
+#define PREEMPT_WORK	20000000
+
+struct result {
+	const char *name;
+	const char *impl;
+	const char *unit;
+	size_t ops;
+	size_t count;
+	double *samples;
+	struct perf_counts perf;
+};
+
+static size_t nsamples = SAMPLES;
+static bool perf;
+
+/* Samples of the benchmark being run */
+static double *samples;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted samples */
+static double percentile(const struct result *r, double p)
+{
+	size_t rank = (size_t)(p / 100 * (r->count - 1) + 0.5);
+
+	return r->samples[rank];
+}
+
+static double mean(const struct result *r)
+{
+	double sum = 0;
+	size_t i;
+
+	for (i = 0; i < r->count; i++)
+		sum += r->samples[i];
+	return sum / r->count;
+}
+
+/*
+ * Yield: two threads yielding to each other, every yield is a switch to the
+ * other thread and back. Both threads are created with the attributes below.
+ */
+static volatile bool yield_done;
+static uthread_attr_t yield_attr;
+
+static void yield_partner(void *arg)
+{
+	(void)arg;
+
+	while (!yield_done)
+		uthread_yield();
+}
+
+static void yield_timer(void *arg)
+{
+	size_t s, i;
+	double start;
+	(void)arg;
+
+	yield_done = false;
+	uthread_create_attr(NULL, &yield_attr, yield_partner, NULL);
+	uthread_yield();
+
+	perf_start();
+	for (s = 0; s < nsamples; s++) {
+		start = now_ns();
+		for (i = 0; i < BATCH; i++)
+			uthread_yield();
+		samples[s] = (now_ns() - start) / (2 * BATCH);
+	}
+	perf_stop();
+	yield_done = true;
+}
+
+static void yield_start(void *arg)
+{
+	(void)arg;
+
+	uthread_create_attr(NULL, &yield_attr, yield_timer, NULL);
+}
+
+static size_t bench_yield(bool integer_only)
+{
+	uthread_attr_init(&yield_attr);
+	yield_attr.integer_only = integer_only;
+	uthread_run(false, yield_start, NULL);
+	return nsamples;
+}
+
+static size_t bench_yield_uthread(void)
+{
+	return bench_yield(false);
+}
+
+static size_t bench_yield_uthread_int(void)
+{
+	return bench_yield(true);
+}
+
+static ucontext_t main_ctx, partner_ctx;
+
+static void swap_partner(void)
+{
+	while (1)
+		swapcontext(&partner_ctx, &main_ctx);
+}
+
+static size_t bench_yield_swapcontext(void)
+{
+	char *stack = malloc(STACK_SIZE);
+	size_t s, i;
+	double start;
+
+	getcontext(&partner_ctx);
+	partner_ctx.uc_stack.ss_sp = stack;
+	partner_ctx.uc_stack.ss_size = STACK_SIZE;
+	partner_ctx.uc_link = NULL;
+	makecontext(&partner_ctx, swap_partner, 0);
+
+	perf_start();
+	for (s = 0; s < nsamples; s++) {
+		start = now_ns();
+		for (i = 0; i < BATCH; i++)
+			swapcontext(&main_ctx, &partner_ctx);
+		samples[s] = (now_ns() - start) / (2 * BATCH);
+	}
+	perf_stop();
+	free(stack);
+	return nsamples;
+}
+
+/*
+ * Create: create a batch of threads doing nothing, then wait for all of them
+ * to be done
+ */
+static void noop(void *arg)
+{
+	(void)arg;
+}
+
+static void create_timer(void *arg)
+{
+	size_t s, i;
+	double start;
+	(void)arg;
+
+	perf_start();
+	for (s = 0; s < nsamples; s++) {
+		start = now_ns();
+		for (i = 0; i < BATCH; i++)
+			uthread_create(noop, NULL);
+		/* Threads run in creation order, all are done when we resume */
+		uthread_yield();
+		samples[s] = (now_ns() - start) / BATCH;
+	}
+	perf_stop();
+}
+
+static size_t bench_create_uthread(void)
+{
+	uthread_run(false, create_timer, NULL);
+	return nsamples;
+}
+
+static void create_batch_timer(void *arg)
+{
+	size_t s;
+	double start;
+	(void)arg;
+
+	perf_start();
+	for (s = 0; s < nsamples; s++) {
+		start = now_ns();
+		uthread_create_batch(BATCH, noop, NULL);
+		uthread_yield();
+		samples[s] = (now_ns() - start) / BATCH;
+	}
+	perf_stop();
+}
+
+static size_t bench_create_batch(void)
+{
+	uthread_run(false, create_batch_timer, NULL);
+	return nsamples;
+}
+
+static void *pthread_noop(void *arg)
+{
+	return arg;
+}
+
+static size_t bench_create_pthread(void)
+{
+	pthread_t threads[BATCH];
+	size_t s, i;
+	double start;
+
+	perf_start();
+	for (s = 0; s < nsamples; s++) {
+		start = now_ns();
+		for (i = 0; i < BATCH; i++)
+			pthread_create(&threads[i], NULL, pthread_noop, NULL);
+		for (i = 0; i < BATCH; i++)
+			pthread_join(threads[i], NULL);
+		samples[s] = (now_ns() - start) / BATCH;
+	}
+	perf_stop();
+	return nsamples;
+}
+
+/* Ping-pong: two threads passing a token back and forth */
+static sem_t ping, pong;
+
+static void pong_thread(void *arg)
+{
+	size_t i, n = nsamples * BATCH;
+	(void)arg;
+
+	for (i = 0; i < n; i++) {
+		sem_down(ping);
+		sem_up(pong);
+	}
+}
+
+static void ping_thread(void *arg)
+{
+	size_t s, i;
+	double start;
+	(void)arg;
+
+	uthread_create(pong_thread, NULL);
+	perf_start();
+	for (s = 0; s < nsamples; s++) {
+		start = now_ns();
+		for (i = 0; i < BATCH; i++) {
+			sem_up(ping);
+			sem_down(pong);
+		}
+		samples[s] = (now_ns() - start) / BATCH;
+	}
+	perf_stop();
+}
+
+static size_t bench_pingpong_uthread(void)
+{
+	ping = sem_create(0);
+	pong = sem_create(0);
+	uthread_run(false, ping_thread, NULL);
+	sem_destroy(ping);
+	sem_destroy(pong);
+	return nsamples;
+}
+
+static pthread_mutex_t token_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t token_cond = PTHREAD_COND_INITIALIZER;
+static int token;
+
+/* Wait for the token to be @from, then set it to @to */
+static void token_pass(int from, int to)
+{
+	pthread_mutex_lock(&token_lock);
+	while (token != from)
+		pthread_cond_wait(&token_cond, &token_lock);
+	token = to;
+	pthread_cond_broadcast(&token_cond);
+	pthread_mutex_unlock(&token_lock);
+}
+
+static void *pthread_pong(void *arg)
+{
+	size_t i, n = nsamples * BATCH;
+
+	for (i = 0; i < n; i++)
+		token_pass(1, 0);
+	return arg;
+}
+
+static size_t bench_pingpong_pthread(void)
+{
+	pthread_t thread;
+	size_t s, i;
+	double start;
+
+	token = 0;
+	pthread_create(&thread, NULL, pthread_pong, NULL);
+	perf_start();
+	for (s = 0; s < nsamples; s++) {
+		start = now_ns();
+		for (i = 0; i < BATCH; i++) {
+			/* Send the token, then wait for it to come back */
+			token_pass(0, 1);
+			token_pass(0, 0);
+		}
+		samples[s] = (now_ns() - start) / BATCH;
+	}
+	perf_stop();
+	pthread_join(thread, NULL);
+	return nsamples;
+}
+
+/*
+ * Handoff: a client hands a request over to a server, which hands the response
+ * back, while background threads are ready to run
+ */
+enum { CLIENT, SERVER };
+
+static volatile int handoff_turn;
+static volatile bool handoff_done;
+static bool handoff_directed;
+static uthread_t handoff_client, handoff_server;
+
+/* Let the thread whose turn it is run */
+static void handoff(uthread_t to)
+{
+	if (handoff_directed)
+		uthread_yield_to(to);
+	else
+		uthread_yield();
+}
+
+static void handoff_background(void *arg)
+{
+	(void)arg;
+
+	while (!handoff_done)
+		uthread_yield();
+}
+
+static void handoff_serve(void *arg)
+{
+	(void)arg;
+
+	while (!handoff_done) {
+		if (handoff_turn == SERVER)
+			handoff_turn = CLIENT;
+		handoff(handoff_client);
+	}
+}
+
+static void handoff_timer(void *arg)
+{
+	size_t s, i;
+	double start;
+	(void)arg;
+
+	handoff_done = false;
+	handoff_turn = CLIENT;
+	handoff_client = uthread_self();
+	uthread_create_attr(&handoff_server, NULL, handoff_serve, NULL);
+	for (i = 0; i < HANDOFF_THREADS; i++)
+		uthread_create(handoff_background, NULL);
+
+	/* Let every thread start */
+	uthread_yield();
+
+	perf_start();
+	for (s = 0; s < nsamples; s++) {
+		start = now_ns();
+		for (i = 0; i < HANDOFF_BATCH; i++) {
+			handoff_turn = SERVER;
+			while (handoff_turn != CLIENT)
+				handoff(handoff_server);
+		}
+		samples[s] = (now_ns() - start) / HANDOFF_BATCH;
+	}
+	perf_stop();
+	handoff_done = true;
+}
+
+static size_t bench_handoff(bool directed)
+{
+	handoff_directed = directed;
+	uthread_run(false, handoff_timer, NULL);
+	return nsamples;
+}
+
+static size_t bench_handoff_yield(void)
+{
+	return bench_handoff(false);
+}
+
+static size_t bench_handoff_yield_to(void)
+{
+	return bench_handoff(true);
+}
+
+/* Queue: a batch of enqueues followed by a batch of dequeues */
+static size_t bench_queue(void)
+{
+	queue_t q = queue_create();
+	size_t s, i;
+	double start;
+	void *data;
+
+	perf_start();
+	for (s = 0; s < nsamples; s++) {
+		start = now_ns();
+		for (i = 0; i < BATCH; i++)
+			queue_enqueue(q, &data);
+		for (i = 0; i < BATCH; i++)
+			queue_dequeue(q, &data);
+		samples[s] = (now_ns() - start) / (2 * BATCH);
+	}
+	perf_stop();
+	queue_destroy(q);
+	return nsamples;
+}
+
+/* Alloc: a batch of small allocations, then all of them are freed */
+#define ALLOC_SIZE	48
+
+static void alloc_malloc_timer(void *arg)
+{
+	void *ptrs[BATCH];
+	size_t s, i;
+	double start;
+	(void)arg;
+
+	perf_start();
+	for (s = 0; s < nsamples; s++) {
+		start = now_ns();
+		for (i = 0; i < BATCH; i++)
+			ptrs[i] = malloc(ALLOC_SIZE);
+		for (i = 0; i < BATCH; i++)
+			free(ptrs[i]);
+		samples[s] = (now_ns() - start) / BATCH;
+	}
+	perf_stop();
+}
+
+static void alloc_arena_timer(void *arg)
+{
+	size_t s, i;
+	double start;
+	(void)arg;
+
+	perf_start();
+	for (s = 0; s < nsamples; s++) {
+		start = now_ns();
+		for (i = 0; i < BATCH; i++)
+			uthread_arena_alloc(ALLOC_SIZE);
+		uthread_arena_reset();
+		samples[s] = (now_ns() - start) / BATCH;
+	}
+	perf_stop();
+}
+
+static size_t bench_alloc_malloc(void)
+{
+	uthread_run(false, alloc_malloc_timer, NULL);
+	return nsamples;
+}
+
+static size_t bench_alloc_arena(void)
+{
+	uthread_run(false, alloc_arena_timer, NULL);
+	return nsamples;
+}
+
+/* Preempt: the same work split between two threads, without then with preemption */
+static volatile unsigned long spin_sink;
+
+static void spin(void *arg)
+{
+	unsigned long i;
+	(void)arg;
+
+	for (i = 0; i < PREEMPT_WORK / 2; i++)
+		spin_sink += i;
+}
+
+static void spin_pair(void *arg)
+{
+	(void)arg;
+
+	uthread_create(spin, NULL);
+	spin(NULL);
+}
+
+static size_t bench_preempt(bool preempt)
+{
+	size_t s;
+	double start;
+
+	perf_start();
+	for (s = 0; s < PREEMPT_RUNS; s++) {
+		start = now_ns();
+		uthread_run(preempt, spin_pair, NULL);
+		samples[s] = now_ns() - start;
+	}
+	perf_stop();
+	return PREEMPT_RUNS;
+}
+
+static size_t bench_preempt_off(void)
+{
+	return bench_preempt(false);
+}
+
+static size_t bench_preempt_on(void)
+{
+	return bench_preempt(true);
+}
+
+#define RESULT(n, i, u, o) { .name = n, .impl = i, .unit = u, .ops = o }
+
+static struct result results[] = {
+	RESULT("yield", "uthread", "ns/switch", 2 * BATCH),
+	RESULT("yield", "uthread int", "ns/switch", 2 * BATCH),
+	RESULT("yield", "swapcontext", "ns/switch", 2 * BATCH),
+	RESULT("create", "uthread", "ns/thread", BATCH),
+	RESULT("create", "uthread batch", "ns/thread", BATCH),
+	RESULT("create", "pthread", "ns/thread", BATCH),
+	RESULT("pingpong", "uthread", "ns/round trip", BATCH),
+	RESULT("pingpong", "pthread", "ns/round trip", BATCH),
+	RESULT("handoff", "yield", "ns/round trip", HANDOFF_BATCH),
+	RESULT("handoff", "yield_to", "ns/round trip", HANDOFF_BATCH),
+	RESULT("queue", "uthread", "ns/op", 2 * BATCH),
+	RESULT("alloc", "malloc", "ns/alloc", BATCH),
+	RESULT("alloc", "arena", "ns/alloc", BATCH),
+	RESULT("preempt", "off", "ns/run", 1),
+	RESULT("preempt", "on", "ns/run", 1),
+};
+
+/* Run a benchmark, return its number of samples */
+static size_t (*benchmarks[])(void) = {
+	bench_yield_uthread,
+	bench_yield_uthread_int,
+	bench_yield_swapcontext,
+	bench_create_uthread,
+	bench_create_batch,
+	bench_create_pthread,
+	bench_pingpong_uthread,
+	bench_pingpong_pthread,
+	bench_handoff_yield,
+	bench_handoff_yield_to,
+	bench_queue,
+	bench_alloc_malloc,
+	bench_alloc_arena,
+	bench_preempt_off,
+	bench_preempt_on,
+};
+
+#define NBENCH (sizeof(results) / sizeof(results[0]))
+
+/* Counter @c of @r per operation, negative if not available */
+static double perf_per_op(const struct result *r, int c)
+{
+	if (!r->perf.valid[c])
+		return -1;
+	return (double)r->perf.value[c] / (r->count * r->ops);
+}
+
+static void print_perf_text(void)
+{
+	size_t b;
+	int c;
+
+	printf("\n%-10s %-12s", "benchmark", "impl");
+	for (c = 0; c < PERF_NCOUNTERS; c++)
+		printf(" %13s", perf_names[c]);
+	printf("  (per operation)\n");
+
+	for (b = 0; b < NBENCH; b++) {
+		struct result *r = &results[b];
+
+		printf("%-10s %-12s", r->name, r->impl);
+		for (c = 0; c < PERF_NCOUNTERS; c++) {
+			if (r->perf.valid[c])
+				printf(" %13.1f", perf_per_op(r, c));
+			else
+				printf(" %13s", "n/a");
+		}
+		printf("\n");
+	}
+}
+
+static void print_text(void)
+{
+	size_t b;
+
+	printf("%-10s %-12s %10s %10s %10s %10s %10s  %s\n", "benchmark",
+	       "impl", "min", "p50", "p90", "p99", "max", "unit");
+	for (b = 0; b < NBENCH; b++) {
+		struct result *r = &results[b];
+
+		printf("%-10s %-12s %10.1f %10.1f %10.1f %10.1f %10.1f  %s\n",
+		       r->name, r->impl, r->samples[0], percentile(r, 50),
+		       percentile(r, 90), percentile(r, 99),
+		       r->samples[r->count - 1], r->unit);
+	}
+
+	printf("preemption overhead: %.2f%%\n",
+	       (percentile(&results[NBENCH - 1], 50) /
+		percentile(&results[NBENCH - 2], 50) - 1) * 100);
+
+	if (perf)
+		print_perf_text();
+}
+
+static void print_json(void)
+{
+	size_t b;
+	int c;
+
+	printf("{\"benchmarks\":[\n");
+	for (b = 0; b < NBENCH; b++) {
+		struct result *r = &results[b];
+
+		printf("{\"name\":\"%s\",\"impl\":\"%s\",\"unit\":\"%s\","
+		       "\"samples\":%zu,\"ops_per_sample\":%zu,\"mean\":%.1f,"
+		       "\"min\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,"
+		       "\"max\":%.1f",
+		       r->name, r->impl, r->unit, r->count, r->ops, mean(r),
+		       r->samples[0], percentile(r, 50), percentile(r, 90),
+		       percentile(r, 99), r->samples[r->count - 1]);
+
+		/* Counters per operation, null when not available */
+		if (perf) {
+			printf(",\"perf\":{");
+			for (c = 0; c < PERF_NCOUNTERS; c++) {
+				printf("%s\"%s\":", c ? "," : "", perf_names[c]);
+				if (r->perf.valid[c])
+					printf("%.3f", perf_per_op(r, c));
+				else
+					printf("null");
+			}
+			printf("}");
+		}
+		printf("}%s\n", b + 1 < NBENCH ? "," : "");
+	}
+	printf("]}\n");
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	bool json = false;
+	size_t b;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--json"))
+			json = true;
+		else if (!strcmp(argv[i], "--perf"))
+			perf = true;
+		else
+			nsamples = get_argv(argv[i]);
+	}
+	if (nsamples < PREEMPT_RUNS)
+		nsamples = PREEMPT_RUNS;
+
+	if (perf && perf_open() == 0)
+		fprintf(stderr, "no hardware counters available\n");
+
+	for (b = 0; b < NBENCH; b++) {
+		struct result *r = &results[b];
+
+		samples = calloc(nsamples, sizeof(double));
+		if (!samples) {
+			perror("calloc");
+			return 1;
+		}
+		r->count = benchmarks[b]();
+		r->samples = samples;
+		perf_read(&r->perf);
+		qsort(r->samples, r->count, sizeof(double), compare_double);
+	}
+
+	if (json)
+		print_json();
+	else
+		print_text();
+
+	for (b = 0; b < NBENCH; b++)
+		free(results[b].samples);
+	perf_close();
+
+	return 0;
+}
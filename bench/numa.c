@@ -0,0 +1,194 @@
+/*
+ * NUMA placement benchmark
+ *
+ * Pins the worker to the first CPU of node 0, then runs N threads that each
+ * fill a buffer on their own (lazily committed) stack and read it back several
+ * times, yielding in between so that all the buffers compete for the caches.
+ * This is run twice:
+ * - local: the stacks are bound to node 0, next to the worker
+ * - remote: the stacks are bound to the last node
+ *
+ * For each run, the time and the change of the kernel's NUMA counters are
+ * reported: other_node counts pages allocated on a node other than the one of
+ * the allocating CPU, i.e., cross-node placements. The counters are
+ * system-wide, so other activity on the machine adds to them.
+ *
+ * The remote run needs at least two nodes. A single machine can be split into
+ * fake nodes for testing by booting with e.g. `numa=fake=2`.
+ *
+ * Usage: numa.x [N] [buffer size in KiB] [passes]
+ */
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <uthread.h>
+
+#define THREADS		64
+#define BUFFER_KIB	512
+#define PASSES		20
+
+struct numa {
+	size_t threads;
+	size_t buffer;
+	size_t passes;
+	volatile unsigned long sink;
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Number of NUMA nodes of the machine */
+static int node_count(void)
+{
+	DIR *dir = opendir("/sys/devices/system/node");
+	struct dirent *entry;
+	int nodes = 0;
+	int id;
+
+	if (!dir)
+		return 1;
+	while ((entry = readdir(dir)))
+		if (sscanf(entry->d_name, "node%d", &id) == 1)
+			nodes++;
+	closedir(dir);
+	return nodes ? nodes : 1;
+}
+
+/* First CPU of @node, 0 if unknown */
+static int node_first_cpu(int node)
+{
+	char path[64];
+	FILE *f;
+	int cpu = 0;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+		 node);
+	f = fopen(path, "r");
+	if (f) {
+		if (fscanf(f, "%d", &cpu) != 1)
+			cpu = 0;
+		fclose(f);
+	}
+	return cpu;
+}
+
+/* Sum of a counter of /sys/devices/system/node/node<i>/numastat, all nodes */
+static unsigned long numastat(int nodes, const char *counter)
+{
+	unsigned long total = 0, value;
+	char path[64], name[32];
+	FILE *f;
+	int node;
+
+	for (node = 0; node < nodes; node++) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/node/node%d/numastat", node);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		while (fscanf(f, "%31s %lu", name, &value) == 2)
+			if (!strcmp(name, counter))
+				total += value;
+		fclose(f);
+	}
+	return total;
+}
+
+static void reader(void *arg)
+{
+	struct numa *n = (struct numa*)arg;
+	volatile unsigned long *buffer = __builtin_alloca(n->buffer);
+	size_t words = n->buffer / sizeof(unsigned long);
+	unsigned long sum = 0;
+	size_t i, pass;
+
+	/* First touch commits the stack pages, on the node they are bound to */
+	for (i = 0; i < words; i++)
+		buffer[i] = i;
+	uthread_yield();
+
+	for (pass = 0; pass < n->passes; pass++) {
+		for (i = 0; i < words; i++)
+			sum += buffer[i];
+		uthread_yield();
+	}
+	n->sink += sum;
+}
+
+static void root(void *arg)
+{
+	struct numa *n = (struct numa*)arg;
+	size_t i;
+
+	for (i = 0; i < n->threads; i++)
+		uthread_create(reader, n);
+}
+
+static void run(struct numa *n, const char *name, int nodes, int cpu, int node)
+{
+	unsigned long other_before = numastat(nodes, "other_node");
+	double start;
+
+	uthread_set_worker_placement(cpu, node);
+	start = now_ns();
+	if (uthread_run(false, root, n)) {
+		fprintf(stderr, "%s: cannot run on cpu %d\n", name, cpu);
+		return;
+	}
+
+	printf("%-8s cpu %3d  stacks on node %d  %8.1f ms  other_node +%lu pages\n",
+	       name, cpu, node, (now_ns() - start) / 1e6,
+	       numastat(nodes, "other_node") - other_before);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct numa n;
+	int nodes = node_count();
+	int cpu = node_first_cpu(0);
+
+	n.threads = THREADS;
+	n.buffer = BUFFER_KIB * 1024;
+	n.passes = PASSES;
+	n.sink = 0;
+	if (argc > 1)
+		n.threads = get_argv(argv[1]);
+	if (argc > 2)
+		n.buffer = get_argv(argv[2]) * 1024;
+	if (argc > 3)
+		n.passes = get_argv(argv[3]);
+
+	/* Room for the buffer, plus some for the frames around it */
+	uthread_set_stack_mode(UTHREAD_STACK_LAZY, n.buffer + 64 * 1024);
+
+	printf("%d node(s), %zu threads, %zu KiB each, %zu passes\n", nodes,
+	       n.threads, n.buffer / 1024, n.passes);
+	run(&n, "local", nodes, cpu, 0);
+	if (nodes > 1)
+		run(&n, "remote", nodes, cpu, nodes - 1);
+	else
+		printf("remote   skipped, single node (try booting with numa=fake=2)\n");
+
+	return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * Parallel loop benchmark
+ *
+ * Compares three ways of running a loop on top of the thread library:
+ * - serial: plain loop in a single thread
+ * - per-chunk threads: hand-rolled loop creating one thread per chunk and
+ *   collecting them with a semaphore, as done before the parallel API
+ * - parallel: uthread_parallel_for()/uthread_parallel_reduce()
+ *
+ * Two workloads are measured: the sum of a large array, and counting primes
+ * with a segmented sieve of Eratosthenes (each chunk sieves one segment, as
+ * the filter threads of sem_prime do for one prime).
+ *
+ * Usage: parallel.x [array size] [sieve limit] [grain]
+ */
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <parallel.h>
+#include <sem.h>
+#include <uthread.h>
+
+#define ARRAY_SIZE	(10 * 1000 * 1000)
+#define SIEVE_LIMIT	(10 * 1000 * 1000)
+#define GRAIN		32768
+#define SEGMENT		8192
+
+struct workload {
+	const char *name;
+	size_t size;
+	uthread_reduce_func_t fn;
+	int64_t result;
+	double ns;
+};
+
+struct per_chunk {
+	struct workload *w;
+	size_t begin, end;
+	sem_t done;
+};
+
+static size_t grain = GRAIN;
+static int *array;
+static unsigned int *base_primes;
+static size_t nbase_primes;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int64_t sum_chunk(size_t begin, size_t end, void *ctx)
+{
+	int64_t sum = 0;
+	size_t i;
+	(void)ctx;
+
+	for (i = begin; i < end; i++)
+		sum += array[i];
+	return sum;
+}
+
+/* Count primes in [begin, end) by crossing out multiples of base primes */
+static int64_t sieve_chunk(size_t begin, size_t end, void *ctx)
+{
+	char seg[SEGMENT];
+	size_t i, j, len;
+	int64_t count = 0;
+	(void)ctx;
+
+	for (; begin < end; begin += len) {
+		len = end - begin < sizeof(seg) ? end - begin : sizeof(seg);
+		memset(seg, 1, len);
+		for (i = 0; i < nbase_primes; i++) {
+			size_t p = base_primes[i];
+			size_t start = (begin + p - 1) / p * p;
+
+			if (p * p >= begin + len)
+				break;
+			if (start < p * p)
+				start = p * p;
+			for (j = start; j < begin + len; j += p)
+				seg[j - begin] = 0;
+		}
+		for (i = 0; i < len; i++)
+			count += seg[i] && begin + i >= 2;
+	}
+	return count;
+}
+
+static int64_t add(int64_t a, int64_t b, void *ctx)
+{
+	(void)ctx;
+	return a + b;
+}
+
+static void serial(void *arg)
+{
+	struct workload *w = (struct workload*)arg;
+	double start = now_ns();
+
+	w->result = w->fn(0, w->size, NULL);
+	w->ns = now_ns() - start;
+}
+
+static void chunk_thread(void *arg)
+{
+	struct per_chunk *c = (struct per_chunk*)arg;
+
+	c->w->result += c->w->fn(c->begin, c->end, NULL);
+	sem_up(c->done);
+}
+
+static void per_chunk(void *arg)
+{
+	struct workload *w = (struct workload*)arg;
+	size_t i, n = (w->size + grain - 1) / grain;
+	struct per_chunk *chunks = malloc(n * sizeof(*chunks));
+	sem_t done = sem_create(0);
+	double start = now_ns();
+
+	w->result = 0;
+	for (i = 0; i < n; i++) {
+		chunks[i].w = w;
+		chunks[i].begin = i * grain;
+		chunks[i].end = (i + 1) * grain < w->size ? (i + 1) * grain : w->size;
+		chunks[i].done = done;
+		uthread_create(chunk_thread, &chunks[i]);
+	}
+	for (i = 0; i < n; i++)
+		sem_down(done);
+	w->ns = now_ns() - start;
+
+	sem_destroy(done);
+	free(chunks);
+}
+
+static void parallel(void *arg)
+{
+	struct workload *w = (struct workload*)arg;
+	double start = now_ns();
+
+	uthread_parallel_reduce(0, w->size, grain, 0, w->fn, add, NULL,
+				&w->result);
+	w->ns = now_ns() - start;
+}
+
+static void run(struct workload *w, const char *method, uthread_func_t func)
+{
+	uthread_run(false, func, w);
+	printf("%-6s %-10s %12zu %14lld %10.1f %8.2f\n", w->name, method,
+	       w->size, (long long)w->result, w->ns / 1e6, w->ns / w->size);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct workload sum = { "sum", ARRAY_SIZE, sum_chunk, 0, 0 };
+	struct workload sieve = { "sieve", SIEVE_LIMIT, sieve_chunk, 0, 0 };
+	size_t i, j, root;
+	char *small;
+
+	if (argc > 1)
+		sum.size = get_argv(argv[1]);
+	if (argc > 2)
+		sieve.size = get_argv(argv[2]);
+	if (argc > 3)
+		grain = get_argv(argv[3]);
+
+	array = malloc(sum.size * sizeof(*array));
+	for (i = 0; i < sum.size; i++)
+		array[i] = i % 1000;
+
+	/* Base primes up to the square root of the limit, for all methods */
+	for (root = 1; root * root <= sieve.size; root++)
+		;
+	small = calloc(root + 1, 1);
+	base_primes = malloc((root + 1) * sizeof(*base_primes));
+	for (i = 2; i <= root; i++) {
+		if (small[i])
+			continue;
+		base_primes[nbase_primes++] = i;
+		for (j = i * i; j <= root; j += i)
+			small[j] = 1;
+	}
+	free(small);
+
+	printf("%-6s %-10s %12s %14s %10s %8s\n", "load", "method", "size",
+	       "result", "time (ms)", "ns/elem");
+	run(&sum, "serial", serial);
+	run(&sum, "per-chunk", per_chunk);
+	run(&sum, "parallel", parallel);
+	run(&sieve, "serial", serial);
+	run(&sieve, "per-chunk", per_chunk);
+	run(&sieve, "parallel", parallel);
+
+	free(base_primes);
+	free(array);
+
+	return 0;
+}
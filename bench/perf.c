@@ -0,0 +1,120 @@
+/*
+ * Hardware performance counters for the benchmarks
+ *
+ * Every counter is opened on its own rather than as a group, so that the
+ * counters that are available still work when some of them are not.
+ */
+
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perf.h"
+
+const char *perf_names[PERF_NCOUNTERS] = {
+	[PERF_CYCLES] = "cycles",
+	[PERF_INSTRUCTIONS] = "instructions",
+	[PERF_L1D_MISSES] = "l1d_misses",
+	[PERF_LLC_MISSES] = "llc_misses",
+	[PERF_BRANCH_MISSES] = "branch_misses",
+	[PERF_DTLB_MISSES] = "dtlb_misses",
+};
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+} perf_events[PERF_NCOUNTERS] = {
+	[PERF_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[PERF_L1D_MISSES] = { PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_L1D |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	[PERF_LLC_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	[PERF_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	[PERF_DTLB_MISSES] = { PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_DTLB |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+};
+
+static int perf_fds[PERF_NCOUNTERS] = { -1, -1, -1, -1, -1, -1 };
+
+int perf_open(void)
+{
+	struct perf_event_attr attr;
+	int opened = 0;
+	int c;
+
+	for (c = 0; c < PERF_NCOUNTERS; c++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = perf_events[c].type;
+		attr.config = perf_events[c].config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+			PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		perf_fds[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (perf_fds[c] >= 0)
+			opened++;
+	}
+	return opened;
+}
+
+void perf_close(void)
+{
+	int c;
+
+	for (c = 0; c < PERF_NCOUNTERS; c++) {
+		if (perf_fds[c] >= 0)
+			close(perf_fds[c]);
+		perf_fds[c] = -1;
+	}
+}
+
+void perf_start(void)
+{
+	int c;
+
+	for (c = 0; c < PERF_NCOUNTERS; c++) {
+		if (perf_fds[c] < 0)
+			continue;
+		ioctl(perf_fds[c], PERF_EVENT_IOC_RESET, 0);
+		ioctl(perf_fds[c], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+void perf_stop(void)
+{
+	int c;
+
+	for (c = 0; c < PERF_NCOUNTERS; c++) {
+		if (perf_fds[c] >= 0)
+			ioctl(perf_fds[c], PERF_EVENT_IOC_DISABLE, 0);
+	}
+}
+
+void perf_read(struct perf_counts *counts)
+{
+	/* Value, time enabled and time running */
+	uint64_t data[3];
+	int c;
+
+	for (c = 0; c < PERF_NCOUNTERS; c++) {
+		counts->valid[c] = perf_fds[c] >= 0 &&
+			read(perf_fds[c], data, sizeof(data)) == sizeof(data) &&
+			data[2] > 0;
+		counts->value[c] = 0;
+		if (!counts->valid[c])
+			continue;
+
+		/* Scale counters that were multiplexed with other events */
+		counts->value[c] = data[2] < data[1] ?
+			(uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+	}
+}
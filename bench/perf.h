@@ -0,0 +1,67 @@
+#ifndef _BENCH_PERF_H
+#define _BENCH_PERF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Hardware performance counters of the benchmarks, read with
+ * perf_event_open(2) for the calling process, in user mode only
+ */
+enum perf_counter {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_L1D_MISSES,
+	PERF_LLC_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_DTLB_MISSES,
+	PERF_NCOUNTERS,
+};
+
+/*
+ * struct perf_counts - Counter values over a measured region
+ * @value: Value of every counter
+ * @valid: Whether every counter could be opened and was counting
+ */
+struct perf_counts {
+	uint64_t value[PERF_NCOUNTERS];
+	bool valid[PERF_NCOUNTERS];
+};
+
+/* Short names of the counters, for reports */
+extern const char *perf_names[PERF_NCOUNTERS];
+
+/*
+ * perf_open - Open the counters
+ *
+ * Counters that are not supported (e.g., in a virtual machine) or not
+ * permitted (see /proc/sys/kernel/perf_event_paranoid) are left out.
+ *
+ * Return: Number of counters opened
+ */
+int perf_open(void);
+
+/* perf_close - Close the counters */
+void perf_close(void);
+
+/*
+ * perf_start - Reset and start the counters
+ *
+ * Starts the measure of a region, does nothing if perf_open() was not called.
+ */
+void perf_start(void);
+
+/*
+ * perf_stop - Stop the counters
+ *
+ * Ends the measure of a region, whose counts are then given by perf_read().
+ */
+void perf_stop(void);
+
+/*
+ * perf_read - Read the counts of the last measured region
+ * @counts: Address where the counts are received
+ */
+void perf_read(struct perf_counts *counts);
+
+#endif /* _BENCH_PERF_H */
@@ -0,0 +1,167 @@
+/*
+ * Thread scale test
+ *
+ * Creates N mostly idle threads (1,000,000 by default) with lazily committed
+ * stacks, parks them all on a latch, and reports the resident memory of the
+ * process compared to the address space reserved for the stacks. One extra
+ * thread recurses deep enough to overflow a regular 32 KiB stack, to show
+ * that large stacks are still available to threads that need them.
+ *
+ * Every stack is a separate mapping plus its guard page, so creating a million
+ * threads requires raising vm.max_map_count above 2,000,000. If a thread
+ * cannot be created, the test carries on with the threads created so far.
+ *
+ * Usage: scale.x [N] [stack size in KiB]
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <barrier.h>
+#include <uthread.h>
+
+#define COUNT		1000000
+#define STACK_KIB	1024
+#define DEPTH_KIB	512
+
+struct scale {
+	size_t count;
+	size_t created;
+	uthread_latch_t gate;
+	uthread_waitgroup_t wg;
+	size_t depth;
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Resident and virtual memory of the process, in KiB */
+static void memory_kib(size_t *rss, size_t *vsz)
+{
+	FILE *f = fopen("/proc/self/statm", "r");
+	size_t pages = sysconf(_SC_PAGESIZE) / 1024;
+	unsigned long size = 0, resident = 0;
+
+	if (f) {
+		if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+			size = resident = 0;
+		fclose(f);
+	}
+	*rss = resident * pages;
+	*vsz = size * pages;
+}
+
+/* Use about 1 KiB of stack per level */
+static size_t recurse(size_t depth)
+{
+	volatile char frame[1024];
+
+	memset((char*)frame, (int)depth, sizeof(frame));
+	if (depth == 0)
+		return frame[0];
+	return recurse(depth - 1) + frame[depth % sizeof(frame)];
+}
+
+static void deep(void *arg)
+{
+	struct scale *s = (struct scale*)arg;
+
+	recurse(s->depth);
+	printf("deep thread recursed through %zu KiB of stack\n", s->depth);
+	uthread_waitgroup_done(s->wg);
+}
+
+static void idle(void *arg)
+{
+	struct scale *s = (struct scale*)arg;
+
+	uthread_latch_wait(s->gate);
+	uthread_waitgroup_done(s->wg);
+}
+
+static void root(void *arg)
+{
+	struct scale *s = (struct scale*)arg;
+	size_t rss_before, rss, vsz;
+	double start, created, parked;
+
+	memory_kib(&rss_before, &vsz);
+
+	uthread_waitgroup_add(s->wg, 1);
+	uthread_create(deep, s);
+
+	start = now_ns();
+	for (s->created = 0; s->created < s->count; s->created++) {
+		uthread_waitgroup_add(s->wg, 1);
+		if (uthread_create(idle, s)) {
+			uthread_waitgroup_done(s->wg);
+			fprintf(stderr, "stopped after %zu threads "
+				"(check vm.max_map_count)\n", s->created);
+			break;
+		}
+	}
+	created = now_ns();
+
+	/* Let every thread run once and park on the gate */
+	uthread_yield();
+	parked = now_ns();
+
+	memory_kib(&rss, &vsz);
+	printf("threads:          %zu\n", s->created);
+	printf("create time:      %.1f ms (%.0f ns/thread)\n",
+	       (created - start) / 1e6, (created - start) / s->created);
+	printf("first run time:   %.1f ms\n", (parked - created) / 1e6);
+	printf("virtual size:     %zu MiB\n", vsz / 1024);
+	printf("resident size:    %zu MiB (%zu MiB before creation)\n",
+	       rss / 1024, rss_before / 1024);
+	printf("resident/thread:  %.2f KiB\n",
+	       (double)(rss - rss_before) / s->created);
+
+	uthread_latch_count_down(s->gate);
+	uthread_waitgroup_wait(s->wg);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct scale s;
+	size_t stack_kib = STACK_KIB;
+
+	s.count = COUNT;
+	if (argc > 1)
+		s.count = get_argv(argv[1]);
+	if (argc > 2)
+		stack_kib = get_argv(argv[2]);
+
+	/* Stay well within the stack, frames are a bit larger than 1 KiB */
+	s.depth = stack_kib / 2 < DEPTH_KIB ? stack_kib / 2 : DEPTH_KIB;
+	s.gate = uthread_latch_create(1);
+	s.wg = uthread_waitgroup_create();
+
+	uthread_set_stack_mode(UTHREAD_STACK_LAZY, stack_kib * 1024);
+	uthread_run(false, root, &s);
+
+	uthread_latch_destroy(s.gate);
+	uthread_waitgroup_destroy(s.wg);
+
+	return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * Stack placement benchmark
+ *
+ * Creates N threads (100,000 by default) that keep yielding to each other,
+ * so that every switch lands on the stack of another thread, and reports the
+ * switch throughput for every stack mode:
+ * - mmap: 8 KiB stacks mapped one by one, with their guard page
+ * - heap: 8 KiB stacks allocated from the heap
+ * - huge: 8 KiB stacks carved from 2 MiB arenas backed by huge pages
+ * The threads are integer-only, to leave the signal mask system call of the
+ * regular switch out of the measure.
+ *
+ * The memory of the process backed by transparent huge pages is reported too,
+ * to check that the huge mode got some. With --perf, data TLB misses and
+ * cycles per switch are also reported, as long as the machine provides them.
+ *
+ * Every mapped stack takes two mappings, so creating more than about 30,000
+ * threads in the mmap mode requires raising vm.max_map_count. The mmap mode
+ * runs first for that reason: if a thread cannot be created in any mode, N is
+ * lowered to the threads created so far and every mode runs again, so that
+ * all the rows are measured with the same number of threads. Without huge
+ * pages, explicit or transparent, the huge mode is skipped.
+ *
+ * Usage: stacks.x [--perf] [N]
+ */
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <barrier.h>
+#include <uthread.h>
+
+#include "perf.h"
+
+#define COUNT		100000
+#define ROUNDS		20
+#define STACK_SIZE	8192
+
+struct mode {
+	const char *name;
+	uthread_stack_mode_t mode;
+	bool skipped;
+	size_t created;
+	size_t thp_kib;
+	double ns;
+	struct perf_counts perf;
+};
+
+static struct mode modes[] = {
+	{ .name = "mmap", .mode = UTHREAD_STACK_LAZY },
+	{ .name = "heap", .mode = UTHREAD_STACK_HEAP },
+	{ .name = "huge", .mode = UTHREAD_STACK_HUGE },
+};
+
+#define NMODES (sizeof(modes) / sizeof(modes[0]))
+
+static size_t count = COUNT;
+static bool perf;
+static uthread_waitgroup_t wg;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Memory of the process backed by transparent huge pages, in KiB */
+static size_t thp_kib(void)
+{
+	FILE *f = fopen("/proc/self/smaps_rollup", "r");
+	char line[256];
+	size_t kib = 0;
+
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "AnonHugePages: %zu kB", &kib) == 1)
+			break;
+	fclose(f);
+	return kib;
+}
+
+/*
+ * Yield ROUNDS times after a first turn, touching the stack in between like
+ * real work would
+ */
+static void switcher(void *arg)
+{
+	volatile char frame[64];
+	int i;
+	(void)arg;
+
+	for (i = 0; i <= ROUNDS; i++) {
+		memset((char*)frame, i, sizeof(frame));
+		uthread_yield();
+	}
+	uthread_waitgroup_done(wg);
+}
+
+static void root(void *arg)
+{
+	struct mode *m = (struct mode*)arg;
+	uthread_attr_t attr;
+	double start;
+
+	uthread_attr_init(&attr);
+	attr.integer_only = true;
+	if (m->mode == UTHREAD_STACK_HEAP)
+		attr.stack_size = STACK_SIZE;
+
+	uthread_waitgroup_add(wg, count);
+	for (m->created = 0; m->created < count; m->created++) {
+		if (uthread_create_attr(NULL, &attr, switcher, NULL)) {
+			uthread_waitgroup_add(wg, -(long)(count - m->created));
+			break;
+		}
+	}
+
+	/* Let every thread fault its stack in during a first turn */
+	uthread_yield();
+	m->thp_kib = thp_kib();
+
+	/* Every thread gets one turn per round */
+	perf_start();
+	start = now_ns();
+	uthread_waitgroup_wait(wg);
+	m->ns = (now_ns() - start) / (m->created * ROUNDS);
+	perf_stop();
+	perf_read(&m->perf);
+}
+
+static void print_counter(const struct mode *m, int c)
+{
+	if (m->perf.valid[c])
+		printf(" %12.2f", (double)m->perf.value[c] /
+		       (m->created * ROUNDS));
+	else
+		printf(" %12s", "n/a");
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	bool again;
+	size_t i;
+	int a;
+
+	for (a = 1; a < argc; a++) {
+		if (!strcmp(argv[a], "--perf"))
+			perf = true;
+		else
+			count = get_argv(argv[a]);
+	}
+
+	if (perf && perf_open() == 0)
+		fprintf(stderr, "no hardware counters available\n");
+
+	wg = uthread_waitgroup_create();
+	do {
+		again = false;
+		for (i = 0; i < NMODES && !again; i++) {
+			if (modes[i].skipped)
+				continue;
+			if (uthread_set_stack_mode(modes[i].mode, STACK_SIZE)) {
+				fprintf(stderr, "%s: no huge pages, skipped\n",
+					modes[i].name);
+				modes[i].skipped = true;
+				continue;
+			}
+			uthread_run(false, root, &modes[i]);
+			if (modes[i].created == count)
+				continue;
+
+			/* Not printed by root, whose small stack stdio would overflow */
+			fprintf(stderr, "%s: stopped after %zu threads "
+				"(check vm.max_map_count)\n", modes[i].name,
+				modes[i].created);
+			if (modes[i].created == 0) {
+				uthread_waitgroup_destroy(wg);
+				return 1;
+			}
+			count = modes[i].created;
+			again = true;
+		}
+	} while (again);
+	uthread_waitgroup_destroy(wg);
+
+	printf("%-6s %10s %10s %12s", "stacks", "threads", "thp MiB", "ns/switch");
+	if (perf)
+		printf(" %12s %12s", perf_names[PERF_DTLB_MISSES],
+		       perf_names[PERF_CYCLES]);
+	printf("\n");
+	for (i = 0; i < NMODES; i++) {
+		if (modes[i].skipped)
+			continue;
+		printf("%-6s %10zu %10zu %12.1f", modes[i].name,
+		       modes[i].created, modes[i].thp_kib / 1024, modes[i].ns);
+		if (perf) {
+			print_counter(&modes[i], PERF_DTLB_MISSES);
+			print_counter(&modes[i], PERF_CYCLES);
+		}
+		printf("\n");
+	}
+
+	perf_close();
+	return 0;
+}
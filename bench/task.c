@@ -0,0 +1,132 @@
+/*
+ * Task spawn benchmark
+ *
+ * Measures the cost of spawning and running N short functions, either as
+ * regular threads with uthread_create() or as tasks with uthread_task_spawn().
+ * A given percentage of the functions block once on a semaphore, to show the
+ * cost of promoting a task to a thread.
+ *
+ * Usage: task.x [N] [percentage of blocking functions]
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <barrier.h>
+#include <sem.h>
+#include <task.h>
+#include <uthread.h>
+
+#define COUNT		100000
+#define BLOCKING	1
+
+struct test {
+	size_t count;
+	size_t blocking;
+	int use_tasks;
+	sem_t sem;
+	uthread_waitgroup_t wg;
+	double ns;
+};
+
+static unsigned long counter;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void work(void *arg)
+{
+	struct test *t = (struct test*)arg;
+
+	counter++;
+	uthread_waitgroup_done(t->wg);
+}
+
+static void blocking_work(void *arg)
+{
+	struct test *t = (struct test*)arg;
+
+	sem_down(t->sem);
+	counter++;
+	uthread_waitgroup_done(t->wg);
+}
+
+static void spawner(void *arg)
+{
+	struct test *t = (struct test*)arg;
+	size_t i, every = t->blocking ? 100 / t->blocking : 0;
+	double start = now_ns();
+
+	uthread_waitgroup_add(t->wg, t->count);
+	for (i = 0; i < t->count; i++) {
+		uthread_func_t func = work;
+
+		if (every && i % every == 0)
+			func = blocking_work;
+		if (t->use_tasks)
+			uthread_task_spawn(func, t);
+		else
+			uthread_create(func, t);
+	}
+
+	/* Let everybody run, then release the blocked ones */
+	uthread_yield();
+	for (i = 0; every && i < t->count; i += every)
+		sem_up(t->sem);
+	uthread_waitgroup_wait(t->wg);
+
+	t->ns = now_ns() - start;
+}
+
+static void run(struct test *t, int use_tasks)
+{
+	t->use_tasks = use_tasks;
+	t->sem = sem_create(0);
+	t->wg = uthread_waitgroup_create();
+
+	uthread_run(false, spawner, t);
+
+	printf("%-8s %10zu %9zu%% %12.1f %10.1f\n",
+	       use_tasks ? "task" : "thread", t->count, t->blocking,
+	       t->ns / 1e6, t->ns / t->count);
+
+	sem_destroy(t->sem);
+	uthread_waitgroup_destroy(t->wg);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct test t = { COUNT, BLOCKING, 0, NULL, NULL, 0 };
+
+	if (argc > 1)
+		t.count = get_argv(argv[1]);
+	if (argc > 2)
+		t.blocking = get_argv(argv[2]);
+	if (t.blocking > 100)
+		t.blocking = 100;
+
+	printf("%-8s %10s %10s %12s %10s\n", "kind", "count", "blocking",
+	       "time (ms)", "ns/spawn");
+	run(&t, 0);
+	run(&t, 1);
+
+	return 0;
+}
@@ -0,0 +1,318 @@
+/*
+ * Thread control block layout benchmark
+ *
+ * Shows the cost of the TCB layout at 100,000 threads (by default):
+ * - layout: a scheduler-like walk over every thread, reading its state and
+ *   priority and updating its ready queue link and timestamp, in a shuffled
+ *   order as after a while of scheduling. It is run on two copies of the TCB
+ *   layout: the former one, with the context and its FPU area first and the
+ *   scheduler fields spread after it, and the current one, with the scheduler
+ *   fields in the first cache line. Both are allocated one by one, aligned on
+ *   a cache line, like the library does.
+ * - library: the threads of the library themselves, parked on a latch by a
+ *   first run, then all woken up at once by the latch, then run until they
+ *   exit. Compare these between builds of the library.
+ *
+ * Times are given per thread. With --perf, L1 data cache misses per thread are
+ * also reported, as long as the machine provides them.
+ *
+ * Usage: tcb.x [--perf] [N]
+ */
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+
+#include <barrier.h>
+#include <uthread.h>
+
+#include "perf.h"
+
+#define COUNT		100000
+#define ROUNDS		20
+#define STACK_SIZE	UTHREAD_STACK_MIN
+#define CACHE_LINE	64
+
+/* State of the threads walked over, as numbered by the library */
+#define READY		1
+
+/* Former layout of the TCB: context first, scheduler fields after it */
+struct tcb_legacy {
+	ucontext_t ctx;
+	void *stack;
+	size_t stack_size;
+	int stack_mode;
+	bool stack_owned;
+	int state;
+	int priority;
+	uint32_t id;
+	char name[16];
+	uint64_t state_since;
+	uint64_t stats[6];
+	void *keys[8];
+	void **keys_overflow;
+	size_t keys_overflow_len;
+	void *batch;
+	void *ready_handle;
+	void *arena;
+};
+
+/* Current layout of the TCB: scheduler fields in the first cache line */
+struct tcb_split {
+	_Alignas(CACHE_LINE) int state;
+	int priority;
+	uint32_t id;
+	void *ready_handle;
+	uint64_t state_since;
+	void *stack;
+	size_t stack_size;
+
+	_Alignas(CACHE_LINE) uint64_t stats[6];
+	int stack_mode;
+	bool stack_owned;
+	void *batch;
+	void *arena;
+	void *keys[8];
+	void **keys_overflow;
+	size_t keys_overflow_len;
+	char name[16];
+	ucontext_t ctx;
+};
+
+struct row {
+	const char *name;
+	const char *impl;
+	double ns;
+	struct perf_counts perf;
+};
+
+static size_t count = COUNT;
+static bool perf;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void print_row(struct row *r)
+{
+	printf("%-8s %-12s %10.1f ns/thread", r->name, r->impl, r->ns);
+	if (perf) {
+		if (r->perf.valid[PERF_L1D_MISSES])
+			printf(" %8.2f %s/thread",
+			       (double)r->perf.value[PERF_L1D_MISSES] / count,
+			       perf_names[PERF_L1D_MISSES]);
+		else
+			printf(" %8s %s/thread", "n/a",
+			       perf_names[PERF_L1D_MISSES]);
+	}
+	printf("\n");
+}
+
+/* Offsets of the fields read and written by the walk, in a layout */
+struct layout {
+	const char *impl;
+	size_t size;
+	size_t state;
+	size_t priority;
+	size_t ready_handle;
+	size_t state_since;
+};
+
+#define LAYOUT(type, name) {						\
+	.impl = name,							\
+	.size = sizeof(type),						\
+	.state = offsetof(type, state),					\
+	.priority = offsetof(type, priority),				\
+	.ready_handle = offsetof(type, ready_handle),			\
+	.state_since = offsetof(type, state_since),			\
+}
+
+static const struct layout layouts[] = {
+	LAYOUT(struct tcb_legacy, "former"),
+	LAYOUT(struct tcb_split, "current"),
+};
+
+#define FIELD(t, type, offset) (*(type*)((char*)(t) + (offset)))
+
+/* Fisher-Yates shuffle of the walk order */
+static void shuffle(char **order)
+{
+	size_t i, j;
+	char *tmp;
+
+	srand(1);
+	for (i = count - 1; i > 0; i--) {
+		j = (size_t)rand() % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+}
+
+/*
+ * Allocate @count TCBs of layout @l, then walk them ROUNDS times like the
+ * scheduler would, in a shuffled order
+ */
+static void bench_layout(const struct layout *l)
+{
+	struct row r = { "layout", l->impl, 0, { { 0 }, { 0 } } };
+	char **order = malloc(count * sizeof(char*));
+	uint64_t stamp = 0;
+	size_t round, i, ready = 0;
+	double start;
+	char *t;
+
+	if (!order) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < count; i++) {
+		order[i] = aligned_alloc(CACHE_LINE, l->size);
+		if (!order[i]) {
+			perror("aligned_alloc");
+			exit(1);
+		}
+		memset(order[i], 0, l->size);
+		FIELD(order[i], int, l->state) = READY;
+		FIELD(order[i], int, l->priority) = 1;
+	}
+	shuffle(order);
+
+	perf_start();
+	start = now_ns();
+	for (round = 0; round < ROUNDS; round++) {
+		for (i = 0; i < count; i++) {
+			t = order[i];
+			if (FIELD(t, int, l->state) == READY &&
+			    FIELD(t, int, l->priority) == 1) {
+				FIELD(t, void*, l->ready_handle) = NULL;
+				FIELD(t, uint64_t, l->state_since) = ++stamp;
+				ready++;
+			}
+		}
+	}
+	r.ns = (now_ns() - start) / ROUNDS / count;
+	perf_stop();
+	perf_read(&r.perf);
+	r.perf.value[PERF_L1D_MISSES] /= ROUNDS;
+	print_row(&r);
+
+	if (ready != ROUNDS * count)
+		fprintf(stderr, "layout: unexpected state\n");
+	for (i = 0; i < count; i++)
+		free(order[i]);
+	free(order);
+}
+
+struct library {
+	uthread_latch_t gate;
+	uthread_waitgroup_t wg;
+};
+
+static void parked(void *arg)
+{
+	struct library *l = (struct library*)arg;
+
+	uthread_latch_wait(l->gate);
+	uthread_waitgroup_done(l->wg);
+}
+
+static void measure(struct row *r, double start)
+{
+	r->ns = (now_ns() - start) / count;
+	perf_stop();
+	perf_read(&r->perf);
+	print_row(r);
+}
+
+static void root(void *arg)
+{
+	struct library *l = (struct library*)arg;
+	struct row first = { "library", "first run", 0, { { 0 }, { 0 } } };
+	struct row wake = { "library", "wake all", 0, { { 0 }, { 0 } } };
+	struct row run = { "library", "run to exit", 0, { { 0 }, { 0 } } };
+	uthread_attr_t attr;
+	double start;
+	size_t i;
+
+	uthread_attr_init(&attr);
+	attr.stack_size = STACK_SIZE;
+	uthread_waitgroup_add(l->wg, count);
+	for (i = 0; i < count; i++) {
+		if (uthread_create_attr(NULL, &attr, parked, l)) {
+			fprintf(stderr, "could not create thread %zu\n", i);
+			exit(1);
+		}
+	}
+
+	/* Every thread runs once and blocks on the gate */
+	perf_start();
+	start = now_ns();
+	uthread_yield();
+	measure(&first, start);
+
+	/* The gate makes all of them Ready at once */
+	perf_start();
+	start = now_ns();
+	uthread_latch_count_down(l->gate);
+	measure(&wake, start);
+
+	/* Every thread runs again and exits */
+	perf_start();
+	start = now_ns();
+	uthread_waitgroup_wait(l->wg);
+	measure(&run, start);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct library l;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--perf"))
+			perf = true;
+		else
+			count = get_argv(argv[i]);
+	}
+	if (count == 0)
+		count = 1;
+
+	if (perf && perf_open() == 0)
+		fprintf(stderr, "no hardware counters available\n");
+
+	printf("threads: %zu, TCB sizes: %zu (former), %zu (current) bytes\n",
+	       count, sizeof(struct tcb_legacy), sizeof(struct tcb_split));
+	for (i = 0; i < 2; i++)
+		bench_layout(&layouts[i]);
+
+	l.gate = uthread_latch_create(1);
+	l.wg = uthread_waitgroup_create();
+	uthread_run(false, root, &l);
+	uthread_latch_destroy(l.gate);
+	uthread_waitgroup_destroy(l.wg);
+
+	perf_close();
+	return 0;
+}
@@ -0,0 +1,138 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "private.h"
+#include "uthread.h"
+
+/* Alignment of the allocations, enough for any type */
+#define ARENA_ALIGN 16
+
+struct arena_chunk
+{
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	_Alignas(ARENA_ALIGN) char data[];
+};
+
+/*
+ * Allocate a chunk of @size bytes, with preemption deferred around malloc(),
+ * which also keeps it disabled when the caller disabled it
+ */
+static struct arena_chunk *arena_chunk_alloc(size_t size)
+{
+	struct arena_chunk *chunk;
+
+	preempt_defer_begin();
+	chunk = malloc(sizeof(struct arena_chunk) + size);
+	preempt_defer_end();
+
+	if (chunk)
+	{
+		chunk->size = size;
+		chunk->used = 0;
+	}
+	return chunk;
+}
+
+void *uthread_arena_alloc(size_t size)
+{
+	struct arena_chunk **arena = uthread_arena();
+	struct arena_chunk *chunk;
+	void *ptr;
+
+	if (!arena || size == 0 || size > SIZE_MAX - UTHREAD_ARENA_CHUNK_SIZE)
+	{
+		return NULL;
+	}
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	/*
+	 * Fast path, from the current chunk. The arena belongs to the running
+	 * thread, so being preempted here is harmless.
+	 */
+	chunk = *arena;
+	if (chunk && chunk->size - chunk->used >= size)
+	{
+		ptr = chunk->data + chunk->used;
+		chunk->used += size;
+		return ptr;
+	}
+
+	/* Large allocations get their own chunk, behind the current one */
+	if (size > UTHREAD_ARENA_CHUNK_SIZE / 4)
+	{
+		chunk = arena_chunk_alloc(size);
+		if (!chunk)
+		{
+			return NULL;
+		}
+		chunk->used = size;
+		if (*arena)
+		{
+			chunk->next = (*arena)->next;
+			(*arena)->next = chunk;
+		}
+		else
+		{
+			chunk->next = NULL;
+			*arena = chunk;
+		}
+		return chunk->data;
+	}
+
+	/* Otherwise, start a new current chunk */
+	chunk = arena_chunk_alloc(UTHREAD_ARENA_CHUNK_SIZE);
+	if (!chunk)
+	{
+		return NULL;
+	}
+	chunk->used = size;
+	chunk->next = *arena;
+	*arena = chunk;
+	return chunk->data;
+}
+
+void uthread_arena_reset(void)
+{
+	struct arena_chunk **arena = uthread_arena();
+	struct arena_chunk *keep = NULL;
+	struct arena_chunk *chunk, *next;
+
+	if (!arena)
+	{
+		return;
+	}
+
+	/* Keep one regular chunk, to serve the next allocations */
+	preempt_defer_begin();
+	for (chunk = *arena; chunk; chunk = next)
+	{
+		next = chunk->next;
+		if (!keep && chunk->size == UTHREAD_ARENA_CHUNK_SIZE)
+		{
+			keep = chunk;
+			keep->used = 0;
+			keep->next = NULL;
+		}
+		else
+		{
+			free(chunk);
+		}
+	}
+	*arena = keep;
+	preempt_defer_end();
+}
+
+void arena_free(struct arena_chunk **arena)
+{
+	struct arena_chunk *chunk, *next;
+
+	for (chunk = *arena; chunk; chunk = next)
+	{
+		next = chunk->next;
+		free(chunk);
+	}
+	*arena = NULL;
+}
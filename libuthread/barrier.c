@@ -0,0 +1,253 @@
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "barrier.h"
+#include "pool.h"
+#include "queue.h"
+#include "private.h"
+#include "uthread.h"
+
+struct barrier
+{
+	queue_t waiting_threads;
+	size_t count;
+	size_t arrived;
+};
+
+struct latch
+{
+	queue_t waiting_threads;
+	size_t count;
+};
+
+struct waitgroup
+{
+	queue_t waiting_threads;
+	long counter;
+};
+
+/*
+ * Add the current thread to @waiters and block it. Must be called with
+ * preemption disabled, so that the thread cannot be released before it is
+ * actually blocked.
+ */
+static void wait_on(queue_t waiters)
+{
+	queue_enqueue(waiters, uthread_current());
+	uthread_block();
+}
+
+/* Release all the threads of @waiters at once, if there are any */
+static void release_all(queue_t waiters)
+{
+	if (queue_length(waiters) > 0)
+	{
+		uthread_unblock_all(waiters);
+	}
+}
+
+uthread_barrier_t uthread_barrier_create(size_t count)
+{
+	uthread_barrier_t barrier;
+
+	if (count == 0)
+	{
+		return NULL;
+	}
+
+	barrier = pool_alloc(sizeof(struct barrier));
+	if (!barrier)
+	{
+		return NULL;
+	}
+
+	barrier->waiting_threads = queue_create();
+	if (!barrier->waiting_threads)
+	{
+		pool_free(barrier);
+		return NULL;
+	}
+	barrier->count = count;
+	barrier->arrived = 0;
+	return barrier;
+}
+
+int uthread_barrier_destroy(uthread_barrier_t barrier)
+{
+	if (!barrier || queue_destroy(barrier->waiting_threads) != 0)
+	{
+		return -1;
+	}
+
+	pool_free(barrier);
+	return 0;
+}
+
+int uthread_barrier_wait(uthread_barrier_t barrier)
+{
+	if (!barrier)
+	{
+		return -1;
+	}
+
+	preempt_disable();
+
+	/* Last thread to arrive: reset the barrier and release everyone */
+	if (++barrier->arrived == barrier->count)
+	{
+		barrier->arrived = 0;
+		release_all(barrier->waiting_threads);
+		preempt_enable();
+		return 1;
+	}
+
+	wait_on(barrier->waiting_threads);
+	preempt_enable();
+	return 0;
+}
+
+uthread_latch_t uthread_latch_create(size_t count)
+{
+	uthread_latch_t latch = pool_alloc(sizeof(struct latch));
+
+	if (!latch)
+	{
+		return NULL;
+	}
+
+	latch->waiting_threads = queue_create();
+	if (!latch->waiting_threads)
+	{
+		pool_free(latch);
+		return NULL;
+	}
+	latch->count = count;
+	return latch;
+}
+
+int uthread_latch_destroy(uthread_latch_t latch)
+{
+	if (!latch || queue_destroy(latch->waiting_threads) != 0)
+	{
+		return -1;
+	}
+
+	pool_free(latch);
+	return 0;
+}
+
+int uthread_latch_count_down(uthread_latch_t latch)
+{
+	if (!latch)
+	{
+		return -1;
+	}
+
+	/* Checked with preemption disabled, so that two threads cannot both pass */
+	preempt_disable();
+	if (latch->count == 0)
+	{
+		preempt_enable();
+		return -1;
+	}
+	if (--latch->count == 0)
+	{
+		release_all(latch->waiting_threads);
+	}
+	preempt_enable();
+
+	return 0;
+}
+
+int uthread_latch_wait(uthread_latch_t latch)
+{
+	if (!latch)
+	{
+		return -1;
+	}
+
+	preempt_disable();
+	if (latch->count != 0)
+	{
+		wait_on(latch->waiting_threads);
+	}
+	preempt_enable();
+
+	return 0;
+}
+
+uthread_waitgroup_t uthread_waitgroup_create(void)
+{
+	uthread_waitgroup_t wg = pool_alloc(sizeof(struct waitgroup));
+
+	if (!wg)
+	{
+		return NULL;
+	}
+
+	wg->waiting_threads = queue_create();
+	if (!wg->waiting_threads)
+	{
+		pool_free(wg);
+		return NULL;
+	}
+	wg->counter = 0;
+	return wg;
+}
+
+int uthread_waitgroup_destroy(uthread_waitgroup_t wg)
+{
+	if (!wg || queue_destroy(wg->waiting_threads) != 0)
+	{
+		return -1;
+	}
+
+	pool_free(wg);
+	return 0;
+}
+
+int uthread_waitgroup_add(uthread_waitgroup_t wg, long delta)
+{
+	if (!wg)
+	{
+		return -1;
+	}
+
+	/* Checked with preemption disabled, so that two threads cannot both pass */
+	preempt_disable();
+	if (wg->counter + delta < 0)
+	{
+		preempt_enable();
+		return -1;
+	}
+	wg->counter += delta;
+	if (wg->counter == 0)
+	{
+		release_all(wg->waiting_threads);
+	}
+	preempt_enable();
+
+	return 0;
+}
+
+int uthread_waitgroup_done(uthread_waitgroup_t wg)
+{
+	return uthread_waitgroup_add(wg, -1);
+}
+
+int uthread_waitgroup_wait(uthread_waitgroup_t wg)
+{
+	if (!wg)
+	{
+		return -1;
+	}
+
+	preempt_disable();
+	if (wg->counter != 0)
+	{
+		wait_on(wg->waiting_threads);
+	}
+	preempt_enable();
+
+	return 0;
+}
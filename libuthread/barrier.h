@@ -0,0 +1,157 @@
+#ifndef _BARRIER_H
+#define _BARRIER_H
+
+#include <stddef.h>
+
+/*
+ * uthread_barrier_t - Barrier type
+ *
+ * A barrier makes a fixed number of threads wait for each other. Threads
+ * calling uthread_barrier_wait() are blocked until the last expected thread
+ * arrives, at which point all of them are released at once. The barrier is
+ * then reset and can be used again by the same number of threads.
+ */
+typedef struct barrier *uthread_barrier_t;
+
+/*
+ * uthread_latch_t - Countdown latch type
+ *
+ * A latch is initialized with a count that is decreased by
+ * uthread_latch_count_down(). Threads calling uthread_latch_wait() are blocked
+ * until the count reaches zero, at which point all of them are released at
+ * once. Unlike a barrier, a latch cannot be reset.
+ */
+typedef struct latch *uthread_latch_t;
+
+/*
+ * uthread_waitgroup_t - Wait group type
+ *
+ * A wait group waits for a collection of threads to finish. The parent thread
+ * calls uthread_waitgroup_add() to set the number of threads to wait for, each
+ * of these threads calls uthread_waitgroup_done() when finished, and
+ * uthread_waitgroup_wait() blocks until all of them are done. Once the counter
+ * is back to zero, the wait group can be reused.
+ */
+typedef struct waitgroup *uthread_waitgroup_t;
+
+/*
+ * uthread_barrier_create - Create barrier
+ * @count: Number of threads that must reach the barrier
+ *
+ * Return: Pointer to initialized barrier. NULL if @count is 0 or in case of
+ * failure when allocating the new barrier.
+ */
+uthread_barrier_t uthread_barrier_create(size_t count);
+
+/*
+ * uthread_barrier_destroy - Deallocate a barrier
+ * @barrier: Barrier to deallocate
+ *
+ * Return: -1 if @barrier is NULL or if threads are still waiting on @barrier.
+ * 0 if @barrier was successfully destroyed.
+ */
+int uthread_barrier_destroy(uthread_barrier_t barrier);
+
+/*
+ * uthread_barrier_wait - Wait on a barrier
+ * @barrier: Barrier to wait on
+ *
+ * Block the caller thread until the number of threads given at creation have
+ * called this function. The last thread to arrive is not blocked: it releases
+ * all the waiting threads in a single pass.
+ *
+ * Return: -1 if @barrier is NULL. 1 for the last thread to arrive, 0 for all
+ * the other threads.
+ */
+int uthread_barrier_wait(uthread_barrier_t barrier);
+
+/*
+ * uthread_latch_create - Create countdown latch
+ * @count: Initial count
+ *
+ * Return: Pointer to initialized latch. NULL in case of failure when
+ * allocating the new latch.
+ */
+uthread_latch_t uthread_latch_create(size_t count);
+
+/*
+ * uthread_latch_destroy - Deallocate a latch
+ * @latch: Latch to deallocate
+ *
+ * Return: -1 if @latch is NULL or if threads are still waiting on @latch. 0 if
+ * @latch was successfully destroyed.
+ */
+int uthread_latch_destroy(uthread_latch_t latch);
+
+/*
+ * uthread_latch_count_down - Decrease the count of a latch
+ * @latch: Latch to count down
+ *
+ * When the count reaches zero, all the threads waiting on @latch are released
+ * in a single pass.
+ *
+ * Return: -1 if @latch is NULL or if its count is already zero. 0 otherwise.
+ */
+int uthread_latch_count_down(uthread_latch_t latch);
+
+/*
+ * uthread_latch_wait - Wait for a latch to reach zero
+ * @latch: Latch to wait on
+ *
+ * Block the caller thread until the count of @latch reaches zero. Return
+ * immediately if it already has.
+ *
+ * Return: -1 if @latch is NULL. 0 otherwise.
+ */
+int uthread_latch_wait(uthread_latch_t latch);
+
+/*
+ * uthread_waitgroup_create - Create wait group
+ *
+ * Return: Pointer to initialized wait group, with a counter of zero. NULL in
+ * case of failure when allocating the new wait group.
+ */
+uthread_waitgroup_t uthread_waitgroup_create(void);
+
+/*
+ * uthread_waitgroup_destroy - Deallocate a wait group
+ * @wg: Wait group to deallocate
+ *
+ * Return: -1 if @wg is NULL or if threads are still waiting on @wg. 0 if @wg
+ * was successfully destroyed.
+ */
+int uthread_waitgroup_destroy(uthread_waitgroup_t wg);
+
+/*
+ * uthread_waitgroup_add - Add to the counter of a wait group
+ * @wg: Wait group to modify
+ * @delta: Value to add to the counter, can be negative
+ *
+ * When the counter reaches zero, all the threads waiting on @wg are released in
+ * a single pass.
+ *
+ * Return: -1 if @wg is NULL or if the counter would become negative. 0
+ * otherwise.
+ */
+int uthread_waitgroup_add(uthread_waitgroup_t wg, long delta);
+
+/*
+ * uthread_waitgroup_done - Decrease the counter of a wait group by one
+ * @wg: Wait group to modify
+ *
+ * Return: Same as uthread_waitgroup_add() with a @delta of -1.
+ */
+int uthread_waitgroup_done(uthread_waitgroup_t wg);
+
+/*
+ * uthread_waitgroup_wait - Wait for the counter of a wait group to reach zero
+ * @wg: Wait group to wait on
+ *
+ * Block the caller thread until the counter of @wg reaches zero. Return
+ * immediately if it already is.
+ *
+ * Return: -1 if @wg is NULL. 0 otherwise.
+ */
+int uthread_waitgroup_wait(uthread_waitgroup_t wg);
+
+#endif /* _BARRIER_H */
@@ -1,12 +1,16 @@
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "private.h"
 #include "uthread.h"
 
-/* Size of the stack for a thread (in bytes) */
-#define UTHREAD_STACK_SIZE 32768
-
 void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next)
 {
 	/*
@@ -19,9 +23,82 @@ void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next)
 	}
 }
 
-void *uthread_ctx_alloc_stack(void)
+#if defined(__x86_64__)
+/*
+ * Offsets of the registers in a uthread_ctx_t, where the integer-only switch
+ * below saves them the same way as swapcontext(), so that both can resume a
+ * context saved by the other
+ */
+#define CTX_REG(reg) (offsetof(uthread_ctx_t, uc_mcontext.gregs) + (reg) * sizeof(greg_t))
+_Static_assert(CTX_REG(REG_R8) == 40 && CTX_REG(REG_R9) == 48 &&
+	       CTX_REG(REG_R12) == 72 && CTX_REG(REG_R13) == 80 &&
+	       CTX_REG(REG_R14) == 88 && CTX_REG(REG_R15) == 96 &&
+	       CTX_REG(REG_RDI) == 104 && CTX_REG(REG_RSI) == 112 &&
+	       CTX_REG(REG_RBP) == 120 && CTX_REG(REG_RBX) == 128 &&
+	       CTX_REG(REG_RDX) == 136 && CTX_REG(REG_RCX) == 152 &&
+	       CTX_REG(REG_RSP) == 160 && CTX_REG(REG_RIP) == 168,
+	       "unexpected ucontext_t layout");
+
+void uthread_ctx_swap_int(uthread_ctx_t *prev, uthread_ctx_t *next, int next_int);
+
+/*
+ * uthread_ctx_swap_int - Save the callee-saved registers, stack and return
+ * address of the caller in @prev, then resume @next: by loading its registers
+ * if @next_int, otherwise with setcontext(), which also restores its floating
+ * point environment and signal mask. The argument registers are loaded too,
+ * for contexts prepared by makecontext() that have not run yet.
+ */
+__asm__(
+	"	.text\n"
+	"	.globl	uthread_ctx_swap_int\n"
+	"	.type	uthread_ctx_swap_int, @function\n"
+	"uthread_ctx_swap_int:\n"
+	"	movq	(%rsp), %rax\n"
+	"	movq	%rax, 168(%rdi)\n"
+	"	leaq	8(%rsp), %rax\n"
+	"	movq	%rax, 160(%rdi)\n"
+	"	movq	%rbx, 128(%rdi)\n"
+	"	movq	%rbp, 120(%rdi)\n"
+	"	movq	%r12, 72(%rdi)\n"
+	"	movq	%r13, 80(%rdi)\n"
+	"	movq	%r14, 88(%rdi)\n"
+	"	movq	%r15, 96(%rdi)\n"
+	"	testl	%edx, %edx\n"
+	"	jz	1f\n"
+	"	movq	160(%rsi), %rsp\n"
+	"	movq	128(%rsi), %rbx\n"
+	"	movq	120(%rsi), %rbp\n"
+	"	movq	72(%rsi), %r12\n"
+	"	movq	80(%rsi), %r13\n"
+	"	movq	88(%rsi), %r14\n"
+	"	movq	96(%rsi), %r15\n"
+	"	movq	104(%rsi), %rdi\n"
+	"	movq	136(%rsi), %rdx\n"
+	"	movq	152(%rsi), %rcx\n"
+	"	movq	40(%rsi), %r8\n"
+	"	movq	48(%rsi), %r9\n"
+	"	pushq	168(%rsi)\n"
+	"	movq	112(%rsi), %rsi\n"
+	"	ret\n"
+	"1:	movq	%rsi, %rdi\n"
+	"	jmp	setcontext@PLT\n"
+	"	.size	uthread_ctx_swap_int, .-uthread_ctx_swap_int\n"
+);
+#endif
+
+void uthread_ctx_switch_int(uthread_ctx_t *prev, uthread_ctx_t *next, bool next_int)
 {
-	return malloc(UTHREAD_STACK_SIZE);
+#if defined(__x86_64__)
+	uthread_ctx_swap_int(prev, next, next_int);
+#else
+	(void)next_int;
+	uthread_ctx_switch(prev, next);
+#endif
+}
+
+void *uthread_ctx_alloc_stack(size_t size)
+{
+	return malloc(size);
 }
 
 void uthread_ctx_destroy_stack(void *top_of_stack)
@@ -29,6 +106,314 @@ void uthread_ctx_destroy_stack(void *top_of_stack)
 	free(top_of_stack);
 }
 
+void *uthread_ctx_map_stack(size_t size)
+{
+	size_t guard = sysconf(_SC_PAGESIZE);
+	char *base;
+
+	/*
+	 * Only reserve the address range: with MAP_NORESERVE, no memory nor swap
+	 * is committed until the pages are actually touched
+	 */
+	base = mmap(NULL, size + guard, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+		    -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	/*
+	 * Stacks grow down, so an overflow hits the guard page at the bottom and
+	 * faults instead of silently corrupting the memory below
+	 */
+	if (mprotect(base, guard, PROT_NONE)) {
+		munmap(base, size + guard);
+		return NULL;
+	}
+
+	return base + guard;
+}
+
+void *uthread_ctx_map_stacks(size_t count, size_t size)
+{
+	size_t guard = sysconf(_SC_PAGESIZE);
+	size_t span = size + guard;
+	char *base;
+	size_t i;
+
+	/* A single mapping for all the stacks, see uthread_ctx_map_stack() */
+	base = mmap(NULL, count * span, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+		    -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	/* Every stack keeps its own guard page */
+	for (i = 0; i < count; i++) {
+		if (mprotect(base + i * span, guard, PROT_NONE)) {
+			munmap(base, count * span);
+			return NULL;
+		}
+	}
+
+	return base + guard;
+}
+
+void uthread_ctx_unmap_stack(void *top_of_stack, size_t size)
+{
+	size_t guard = sysconf(_SC_PAGESIZE);
+
+	munmap((char *)top_of_stack - guard, size + guard);
+}
+
+/*
+ * Arena of stacks backed by huge pages. This header takes the first page of
+ * the arena, the stacks follow it.
+ */
+struct stack_arena {
+	struct stack_arena *prev;
+	struct stack_arena *next;
+	size_t stack_size;
+	size_t carved;
+	size_t live;
+	void *free;
+};
+
+/* Arenas with stacks left to give, and how many of them give none */
+static struct stack_arena *huge_arenas;
+static size_t huge_empty;
+
+/*
+ * Whether memory advised with MADV_HUGEPAGE can get transparent huge pages,
+ * which the system may have disabled or not support at all
+ */
+static bool transparent_huge_pages(void)
+{
+	char mode[64];
+	bool enabled;
+	FILE *file;
+
+	file = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+	if (!file)
+		return false;
+	enabled = fgets(mode, sizeof(mode), file) && !strstr(mode, "[never]");
+	fclose(file);
+	return enabled;
+}
+
+/* Whether the system has explicit huge pages reserved */
+static bool explicit_huge_pages(void)
+{
+	unsigned long count;
+	bool reserved;
+	FILE *file;
+
+	file = fopen("/proc/sys/vm/nr_hugepages", "r");
+	if (!file)
+		return false;
+	reserved = fscanf(file, "%lu", &count) == 1 && count > 0;
+	fclose(file);
+	return reserved;
+}
+
+bool uthread_ctx_huge_pages(void)
+{
+	return explicit_huge_pages() || transparent_huge_pages();
+}
+
+/*
+ * Map a new arena, with explicit huge pages if the system has some left, or
+ * else with transparent ones. Without either, the arena would only get small
+ * pages without guards between its stacks, so it is not mapped at all.
+ */
+static struct stack_arena *stack_arena_map(size_t stack_size)
+{
+	struct stack_arena *arena;
+	uintptr_t base, aligned;
+
+	arena = mmap(NULL, UTHREAD_HUGE_ARENA_SIZE, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_HUGETLB,
+		     -1, 0);
+	if (arena == MAP_FAILED) {
+		if (!transparent_huge_pages())
+			return NULL;
+
+		/*
+		 * Otherwise ask for transparent huge pages, which need an arena
+		 * aligned on the huge page size: map twice the size and trim
+		 */
+		base = (uintptr_t)mmap(NULL, 2 * UTHREAD_HUGE_ARENA_SIZE, PROT_READ | PROT_WRITE,
+				       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE,
+				       -1, 0);
+		if ((void *)base == MAP_FAILED)
+			return NULL;
+		aligned = (base + UTHREAD_HUGE_ARENA_SIZE - 1) & ~(uintptr_t)(UTHREAD_HUGE_ARENA_SIZE - 1);
+		if (aligned > base)
+			munmap((void *)base, aligned - base);
+		munmap((void *)(aligned + UTHREAD_HUGE_ARENA_SIZE), base + UTHREAD_HUGE_ARENA_SIZE - aligned);
+		arena = (struct stack_arena *)aligned;
+		if (madvise(arena, UTHREAD_HUGE_ARENA_SIZE, MADV_HUGEPAGE) != 0) {
+			munmap(arena, UTHREAD_HUGE_ARENA_SIZE);
+			return NULL;
+		}
+	}
+	worker_bind(arena, UTHREAD_HUGE_ARENA_SIZE);
+
+	arena->prev = NULL;
+	arena->next = NULL;
+	arena->stack_size = stack_size;
+	arena->carved = 0;
+	arena->live = 0;
+	arena->free = NULL;
+	return arena;
+}
+
+/* Number of stacks of @arena */
+static size_t stack_arena_capacity(struct stack_arena *arena)
+{
+	return (UTHREAD_HUGE_ARENA_SIZE - sysconf(_SC_PAGESIZE)) / arena->stack_size;
+}
+
+static void stack_arena_link(struct stack_arena *arena)
+{
+	arena->prev = NULL;
+	arena->next = huge_arenas;
+	if (huge_arenas)
+		huge_arenas->prev = arena;
+	huge_arenas = arena;
+}
+
+static void stack_arena_unlink(struct stack_arena *arena)
+{
+	if (arena->prev)
+		arena->prev->next = arena->next;
+	else
+		huge_arenas = arena->next;
+	if (arena->next)
+		arena->next->prev = arena->prev;
+}
+
+void *uthread_ctx_alloc_huge_stack(size_t size)
+{
+	struct stack_arena *arena;
+	char *stack;
+
+	for (arena = huge_arenas; arena; arena = arena->next) {
+		if (arena->stack_size == size)
+			break;
+	}
+	if (!arena) {
+		arena = stack_arena_map(size);
+		if (!arena)
+			return NULL;
+		stack_arena_link(arena);
+		huge_empty++;
+	}
+
+	/* Reuse a freed stack, or carve the next one */
+	if (arena->free) {
+		stack = arena->free;
+		arena->free = *(void **)stack;
+	} else {
+		stack = (char *)arena + sysconf(_SC_PAGESIZE) + arena->carved * size;
+		arena->carved++;
+	}
+
+	if (arena->live++ == 0)
+		huge_empty--;
+	if (!arena->free && arena->carved == stack_arena_capacity(arena))
+		stack_arena_unlink(arena);
+	return stack;
+}
+
+void uthread_ctx_free_huge_stack(void *top_of_stack)
+{
+	struct stack_arena *arena = (struct stack_arena *)((uintptr_t)top_of_stack &
+							   ~(uintptr_t)(UTHREAD_HUGE_ARENA_SIZE - 1));
+	bool full = !arena->free && arena->carved == stack_arena_capacity(arena);
+
+	*(void **)top_of_stack = arena->free;
+	arena->free = top_of_stack;
+	if (full)
+		stack_arena_link(arena);
+
+	/*
+	 * Keep one empty arena around, so that a thread exiting and another
+	 * being created do not map and fault a whole arena every time
+	 */
+	if (--arena->live == 0) {
+		if (huge_empty > 0) {
+			stack_arena_unlink(arena);
+			munmap(arena, UTHREAD_HUGE_ARENA_SIZE);
+		} else {
+			huge_empty++;
+		}
+	}
+}
+
+/* Bytes below the stack pointer that a function may use without moving it */
+#if defined(__x86_64__)
+#define STACK_RED_ZONE 128
+#else
+#define STACK_RED_ZONE 0
+#endif
+
+void *uthread_ctx_stack_pointer(const uthread_ctx_t *uctx)
+{
+#if defined(__x86_64__)
+	return (void *)uctx->uc_mcontext.gregs[REG_RSP];
+#else
+	(void)uctx;
+	return NULL;
+#endif
+}
+
+size_t uthread_ctx_stack_resident(void *start, void *end, void **lowest)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t addr = (uintptr_t)start & ~(page - 1);
+	unsigned char vec[256];
+	size_t resident = 0;
+	size_t count, i;
+
+	*lowest = NULL;
+	while (addr < (uintptr_t)end) {
+		/* Query the pages by chunks, to keep the vector on the stack */
+		count = ((uintptr_t)end - addr + page - 1) / page;
+		if (count > sizeof(vec))
+			count = sizeof(vec);
+		if (mincore((void *)addr, count * page, vec))
+			return resident;
+
+		for (i = 0; i < count; i++) {
+			if (vec[i] & 1) {
+				if (!*lowest)
+					*lowest = (void *)(addr + i * page);
+				resident += page;
+			}
+		}
+		addr += count * page;
+	}
+	return resident;
+}
+
+size_t uthread_ctx_release_stack(void *top_of_stack, void *sp)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = ((uintptr_t)top_of_stack + page - 1) & ~(page - 1);
+	uintptr_t end = ((uintptr_t)sp - STACK_RED_ZONE) & ~(page - 1);
+	size_t resident;
+	void *lowest;
+
+	if (end <= start)
+		return 0;
+
+	/* Only whole pages of the stack, and only if some of them are resident */
+	resident = uthread_ctx_stack_resident((void *)start, (void *)end, &lowest);
+	if (resident == 0 || madvise((void *)start, end - start, MADV_DONTNEED))
+		return 0;
+	return resident;
+}
+
 /*
  * uthread_ctx_bootstrap - Thread context bootstrap function
  * @func: Function to be executed by the new thread
@@ -46,7 +431,7 @@ static void uthread_ctx_bootstrap(uthread_func_t func, void *arg)
 	uthread_exit();
 }
 
-int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
+int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack, size_t size,
 		     uthread_func_t func, void *arg)
 {
 	/*
@@ -59,7 +444,7 @@ int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
 	 * Change context @uctx's stack to the specified stack
 	 */
 	uctx->uc_stack.ss_sp = top_of_stack;
-	uctx->uc_stack.ss_size = UTHREAD_STACK_SIZE;
+	uctx->uc_stack.ss_size = size;
 
 	/*
 	 * Finish setting up context @uctx:
@@ -74,3 +459,29 @@ int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
 	return 0;
 }
 
+int uthread_ctx_init_from(uthread_ctx_t *uctx, const uthread_ctx_t *model,
+			  void *top_of_stack, size_t size,
+			  uthread_func_t func, void *arg)
+{
+#if defined(__x86_64__)
+	/*
+	 * Copy the saved context instead of calling getcontext(), which costs a
+	 * system call to read the signal mask. The copy must point to its own
+	 * floating point state rather than to the model's.
+	 */
+	*uctx = *model;
+	uctx->uc_mcontext.fpregs = &uctx->__fpregs_mem;
+#else
+	(void)model;
+	if (getcontext(uctx))
+		return -1;
+#endif
+
+	uctx->uc_stack.ss_sp = top_of_stack;
+	uctx->uc_stack.ss_size = size;
+	makecontext(uctx, (void (*)(void)) uthread_ctx_bootstrap,
+		    2, func, arg);
+
+	return 0;
+}
+
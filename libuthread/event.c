@@ -0,0 +1,555 @@
+#include <poll.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "private.h"
+#include "uthread.h"
+
+/* Poll file descriptors at most this often while threads keep running */
+#define EVENT_POLL_INTERVAL_NS 1000000
+
+/* Initial capacity of the timer heap and of the file descriptor waiters */
+#define EVENT_INITIAL_SIZE 16
+
+/* Index of a timer that is not in the heap */
+#define TIMER_NONE SIZE_MAX
+
+/* Timer of a blocked thread, lives on the stack of the thread */
+struct timer
+{
+	uint64_t deadline;
+	size_t index;
+	struct uthread_tcb *thread;
+	void (*expire)(void *arg);
+	void *arg;
+	bool expired;
+};
+
+/* Thread waiting on a file descriptor, lives on the stack of the thread */
+struct fd_waiter
+{
+	int fd;
+	short events;
+	short revents;
+	struct uthread_tcb *thread;
+};
+
+/* Function submitted by another kernel thread */
+struct submission
+{
+	uthread_func_t func;
+	void *arg;
+	struct submission *next;
+};
+
+/* Eventfd waking the idle thread up when a function is submitted */
+static int wake_fd = -1;
+
+/*
+ * Whether other kernel threads may submit functions and write to the eventfd,
+ * and how many of them are doing so (see wake_enter())
+ */
+static bool wake_open;
+static int wake_users;
+
+/* Timers of the blocked threads, in a binary min-heap on their deadline */
+static struct timer **timers;
+static size_t timer_count;
+static size_t timer_size;
+
+/* Threads waiting on file descriptors, and the poll array built for them */
+static struct fd_waiter **fd_waiters;
+static struct pollfd *pollfds;
+static size_t fd_count;
+static size_t fd_size;
+static uint64_t last_poll;
+
+/* Submissions, pushed by any kernel thread and taken all at once */
+static struct submission *submissions;
+
+/* Number of holds keeping uthread_run() waiting for submissions */
+static int holds;
+
+int event_init(void)
+{
+	/* The poll array always has room for the eventfd */
+	pollfds = malloc(sizeof(struct pollfd));
+	if (!pollfds)
+	{
+		return -1;
+	}
+
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd < 0)
+	{
+		return -1;
+	}
+
+	__atomic_store_n(&wake_open, true, __ATOMIC_SEQ_CST);
+	return 0;
+}
+
+/*
+ * Enter a section using the eventfd from any kernel thread, unless submissions
+ * are closed. The eventfd stays open until the section is left with
+ * wake_leave().
+ */
+static bool wake_enter(void)
+{
+	__atomic_add_fetch(&wake_users, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&wake_open, __ATOMIC_SEQ_CST))
+	{
+		return true;
+	}
+
+	__atomic_sub_fetch(&wake_users, 1, __ATOMIC_RELEASE);
+	return false;
+}
+
+static void wake_leave(void)
+{
+	__atomic_sub_fetch(&wake_users, 1, __ATOMIC_RELEASE);
+}
+
+/* Close submissions, then wait for the kernel threads still submitting */
+static void wake_close(void)
+{
+	__atomic_store_n(&wake_open, false, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&wake_users, __ATOMIC_SEQ_CST) > 0)
+	{
+		sched_yield();
+	}
+}
+
+void event_destroy(void)
+{
+	struct submission *list;
+	struct submission *next;
+
+	/* Submissions left if uthread_run() failed, they cannot run anymore */
+	wake_close();
+	list = __atomic_exchange_n(&submissions, NULL, __ATOMIC_ACQUIRE);
+	while (list)
+	{
+		next = list->next;
+		pool_free(list);
+		list = next;
+	}
+
+	if (wake_fd >= 0)
+	{
+		close(wake_fd);
+		wake_fd = -1;
+	}
+	free(timers);
+	timers = NULL;
+	timer_count = timer_size = 0;
+	free(fd_waiters);
+	free(pollfds);
+	fd_waiters = NULL;
+	pollfds = NULL;
+	fd_count = fd_size = 0;
+}
+
+bool event_waiting(void)
+{
+	return timer_count > 0 || fd_count > 0;
+}
+
+/* Place @timer at index @i of the heap */
+static void timer_set(size_t i, struct timer *timer)
+{
+	timers[i] = timer;
+	timer->index = i;
+}
+
+/* Move the timer at index @i up or down the heap to its place */
+static void timer_sift(size_t i)
+{
+	struct timer *timer = timers[i];
+	size_t child;
+
+	/* Sift up */
+	while (i > 0 && timers[(i - 1) / 2]->deadline > timer->deadline)
+	{
+		timer_set(i, timers[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+
+	/* Sift down */
+	while ((child = 2 * i + 1) < timer_count)
+	{
+		if (child + 1 < timer_count && timers[child + 1]->deadline < timers[child]->deadline)
+		{
+			child++;
+		}
+		if (timers[child]->deadline >= timer->deadline)
+		{
+			break;
+		}
+		timer_set(i, timers[child]);
+		i = child;
+	}
+	timer_set(i, timer);
+}
+
+/* Add a timer to the heap, must be called with preemption disabled */
+static int timer_push(struct timer *timer)
+{
+	size_t size = timer_size ? timer_size * 2 : EVENT_INITIAL_SIZE;
+	struct timer **heap;
+
+	if (timer_count == timer_size)
+	{
+		heap = realloc(timers, size * sizeof(struct timer *));
+		if (!heap)
+		{
+			return -1;
+		}
+		timers = heap;
+		timer_size = size;
+	}
+
+	timers[timer_count] = timer;
+	timer_sift(timer_count++);
+	return 0;
+}
+
+/* Remove @timer from the heap, wherever it is */
+static void timer_remove(struct timer *timer)
+{
+	size_t i = timer->index;
+
+	timer->index = TIMER_NONE;
+	if (i == --timer_count)
+	{
+		return;
+	}
+
+	/* The last timer takes its place */
+	timers[i] = timers[timer_count];
+	timer_sift(i);
+}
+
+/*
+ * Wake the threads whose deadline has passed. A thread woken up by another
+ * thread in the meantime is left alone.
+ */
+static void timers_fire(uint64_t now)
+{
+	struct timer *timer;
+
+	while (timer_count > 0 && timers[0]->deadline <= now)
+	{
+		timer = timers[0];
+		timer_remove(timer);
+		if (uthread_wake(timer->thread))
+		{
+			timer->expired = true;
+			if (timer->expire)
+			{
+				timer->expire(timer->arg);
+			}
+		}
+	}
+}
+
+/*
+ * Poll the file descriptors of the waiters, and the eventfd if @wake is set,
+ * for @timeout milliseconds at most. Waiters whose file descriptor is ready
+ * are woken up.
+ */
+static void fds_poll(bool wake, int timeout)
+{
+	size_t first = wake ? 1 : 0;
+	size_t i, n = 0;
+	uint64_t value;
+
+	if (wake)
+	{
+		pollfds[0].fd = wake_fd;
+		pollfds[0].events = POLLIN;
+	}
+	for (i = 0; i < fd_count; i++)
+	{
+		pollfds[first + i].fd = fd_waiters[i]->fd;
+		pollfds[first + i].events = fd_waiters[i]->events;
+	}
+
+	if (poll(pollfds, first + fd_count, timeout) <= 0)
+	{
+		return;
+	}
+
+	if (wake && pollfds[0].revents)
+	{
+		/*
+		 * Clear the eventfd, submissions are taken by the caller. It is
+		 * non-blocking, so a failed read means it was already cleared.
+		 */
+		if (read(wake_fd, &value, sizeof(value)) < 0)
+		{
+			value = 0;
+		}
+	}
+
+	/* Wake the ready waiters, keeping the others in order */
+	for (i = 0; i < fd_count; i++)
+	{
+		if (pollfds[first + i].revents)
+		{
+			fd_waiters[i]->revents = pollfds[first + i].revents;
+			uthread_wake(fd_waiters[i]->thread);
+		}
+		else
+		{
+			fd_waiters[n++] = fd_waiters[i];
+		}
+	}
+	fd_count = n;
+}
+
+void event_poll(void)
+{
+	uint64_t now = uthread_clock_ns();
+
+	timers_fire(now);
+
+	if (fd_count > 0 && now - last_poll >= EVENT_POLL_INTERVAL_NS)
+	{
+		last_poll = now;
+		fds_poll(false, 0);
+	}
+}
+
+/*
+ * Create a thread for every pending submission, in submission order. Return
+ * whether there were any.
+ */
+static bool submissions_start(void)
+{
+	struct submission *list = __atomic_exchange_n(&submissions, NULL, __ATOMIC_ACQUIRE);
+	struct submission *reversed = NULL;
+	struct submission *next;
+	bool started;
+
+	while (list)
+	{
+		next = list->next;
+		list->next = reversed;
+		reversed = list;
+		list = next;
+	}
+
+	started = reversed != NULL;
+	while (reversed)
+	{
+		next = reversed->next;
+		uthread_create(reversed->func, reversed->arg);
+		pool_free(reversed);
+		reversed = next;
+	}
+	return started;
+}
+
+int event_wait(uint64_t deadline)
+{
+	uint64_t now;
+	int timeout = -1;
+
+	preempt_disable();
+
+	/* Threads created for submissions are ready, no need to sleep */
+	if (submissions_start())
+	{
+		preempt_enable();
+		return 0;
+	}
+
+	if (timer_count == 0 && fd_count == 0 &&
+	    __atomic_load_n(&holds, __ATOMIC_ACQUIRE) == 0 &&
+	    __atomic_load_n(&submissions, __ATOMIC_ACQUIRE) == NULL)
+	{
+		/* Nothing can wake a thread up anymore */
+		preempt_enable();
+		return -1;
+	}
+
+	/* Sleep until the next deadline, a ready descriptor or a submission */
+	now = uthread_clock_ns();
+	if (timer_count > 0 && (!deadline || timers[0]->deadline < deadline))
+	{
+		deadline = timers[0]->deadline;
+	}
+	if (deadline)
+	{
+		timeout = deadline > now ? (deadline - now + 999999) / 1000000 : 0;
+	}
+	fds_poll(true, timeout);
+
+	last_poll = uthread_clock_ns();
+	timers_fire(last_poll);
+	submissions_start();
+	preempt_enable();
+
+	return 0;
+}
+
+int event_close(void)
+{
+	bool started;
+
+	preempt_disable();
+	wake_close();
+	started = submissions_start();
+
+	/* The run goes on with the new threads, which may still be submitted to */
+	if (started)
+	{
+		__atomic_store_n(&wake_open, true, __ATOMIC_SEQ_CST);
+	}
+	preempt_enable();
+
+	return started ? 0 : -1;
+}
+
+int event_block_timeout(uint64_t ns, void (*expire)(void *arg), void *arg)
+{
+	struct timer timer;
+
+	timer.deadline = uthread_clock_ns() + ns;
+	timer.thread = uthread_current();
+	timer.expire = expire;
+	timer.arg = arg;
+	timer.expired = false;
+	if (timer_push(&timer) != 0)
+	{
+		return -1;
+	}
+	uthread_block();
+
+	/* Woken up before the deadline, the timer is still in the heap */
+	preempt_disable();
+	if (timer.index != TIMER_NONE)
+	{
+		timer_remove(&timer);
+	}
+
+	return timer.expired ? 1 : 0;
+}
+
+int uthread_sleep(uint64_t ns)
+{
+	int retval;
+
+	preempt_disable();
+	retval = event_block_timeout(ns, NULL, NULL);
+	preempt_enable();
+
+	return retval < 0 ? -1 : 0;
+}
+
+int uthread_wait_fd(int fd, short events)
+{
+	struct fd_waiter waiter;
+	struct fd_waiter **waiters;
+	struct pollfd *array;
+	size_t size;
+
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	waiter.fd = fd;
+	waiter.events = events;
+	waiter.revents = 0;
+	waiter.thread = uthread_current();
+
+	preempt_disable();
+	if (fd_count == fd_size)
+	{
+		/* One more poll entry than waiters, for the eventfd */
+		size = fd_size ? fd_size * 2 : EVENT_INITIAL_SIZE;
+		waiters = realloc(fd_waiters, size * sizeof(struct fd_waiter *));
+		if (waiters)
+		{
+			fd_waiters = waiters;
+		}
+		array = realloc(pollfds, (size + 1) * sizeof(struct pollfd));
+		if (array)
+		{
+			pollfds = array;
+		}
+		if (!waiters || !array)
+		{
+			preempt_enable();
+			return -1;
+		}
+		fd_size = size;
+	}
+	fd_waiters[fd_count++] = &waiter;
+	uthread_block();
+	preempt_enable();
+
+	return waiter.revents;
+}
+
+int uthread_submit(uthread_func_t func, void *arg)
+{
+	struct submission *sub;
+	uint64_t one = 1;
+	int retval;
+
+	if (!func || !wake_enter())
+	{
+		return -1;
+	}
+
+	sub = pool_alloc(sizeof(struct submission));
+	if (!sub)
+	{
+		wake_leave();
+		return -1;
+	}
+	sub->func = func;
+	sub->arg = arg;
+
+	/* Push on the list, which the idle thread takes all at once */
+	do
+	{
+		sub->next = __atomic_load_n(&submissions, __ATOMIC_RELAXED);
+	} while (!__atomic_compare_exchange_n(&submissions, &sub->next, sub, false,
+					      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	/* Wake the idle thread up in case it sleeps */
+	retval = write(wake_fd, &one, sizeof(one)) == sizeof(one) ? 0 : -1;
+	wake_leave();
+	return retval;
+}
+
+void uthread_hold(void)
+{
+	__atomic_add_fetch(&holds, 1, __ATOMIC_RELEASE);
+}
+
+void uthread_release(void)
+{
+	uint64_t one = 1;
+
+	/* The idle thread may be waiting for the last hold to go */
+	if (__atomic_sub_fetch(&holds, 1, __ATOMIC_RELEASE) == 0 && wake_enter())
+	{
+		if (write(wake_fd, &one, sizeof(one)) < 0)
+		{
+			/* Only fails when the eventfd is already set */
+		}
+		wake_leave();
+	}
+}
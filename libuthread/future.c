@@ -0,0 +1,184 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "future.h"
+#include "pool.h"
+#include "queue.h"
+#include "private.h"
+#include "task.h"
+#include "uthread.h"
+
+struct future
+{
+	queue_t waiting_threads;
+	queue_t continuations;
+	void *value;
+	bool set;
+};
+
+struct continuation
+{
+	uthread_then_func_t func;
+	void *arg;
+	int flags;
+	void *value;
+	uthread_future_t next;
+};
+
+/* Run a continuation and set the future chained after it */
+static void continuation_run(void *arg)
+{
+	struct continuation *cont = (struct continuation *)arg;
+	void *value = cont->func(cont->value, cont->arg);
+	uthread_future_t next = cont->next;
+
+	pool_free(cont);
+	uthread_future_set(next, value);
+}
+
+/* Run @cont now or spawn it as a task, depending on its flags */
+static void continuation_start(struct continuation *cont, void *value)
+{
+	cont->value = value;
+
+	if (cont->flags == UTHREAD_THEN_DEFERRED &&
+	    uthread_task_spawn(continuation_run, cont) == 0)
+	{
+		return;
+	}
+
+	continuation_run(cont);
+}
+
+uthread_future_t uthread_future_create(void)
+{
+	uthread_future_t future = pool_alloc(sizeof(struct future));
+
+	if (!future)
+	{
+		return NULL;
+	}
+
+	future->waiting_threads = queue_create();
+	future->continuations = queue_create();
+	if (!future->waiting_threads || !future->continuations)
+	{
+		queue_destroy(future->waiting_threads);
+		queue_destroy(future->continuations);
+		pool_free(future);
+		return NULL;
+	}
+	future->value = NULL;
+	future->set = false;
+	return future;
+}
+
+int uthread_future_destroy(uthread_future_t future)
+{
+	if (!future || queue_length(future->waiting_threads) > 0 ||
+	    queue_length(future->continuations) > 0)
+	{
+		return -1;
+	}
+
+	queue_destroy(future->waiting_threads);
+	queue_destroy(future->continuations);
+	pool_free(future);
+	return 0;
+}
+
+int uthread_future_set(uthread_future_t future, void *value)
+{
+	struct continuation *cont;
+
+	if (!future)
+	{
+		return -1;
+	}
+
+	preempt_disable();
+	if (future->set)
+	{
+		preempt_enable();
+		return -1;
+	}
+	future->value = value;
+	future->set = true;
+
+	/* Release all the waiters at once */
+	if (queue_length(future->waiting_threads) > 0)
+	{
+		uthread_unblock_all(future->waiting_threads);
+	}
+	preempt_enable();
+
+	/*
+	 * No continuation can be added once the future is set, so the list can
+	 * be drained without preemption disabled
+	 */
+	while (queue_dequeue(future->continuations, (void **)&cont) == 0)
+	{
+		continuation_start(cont, value);
+	}
+
+	return 0;
+}
+
+int uthread_future_get(uthread_future_t future, void **value)
+{
+	if (!future || !value)
+	{
+		return -1;
+	}
+
+	preempt_disable();
+	if (!future->set)
+	{
+		queue_enqueue(future->waiting_threads, uthread_current());
+		uthread_block();
+	}
+	preempt_enable();
+
+	*value = future->value;
+	return 0;
+}
+
+uthread_future_t uthread_future_then(uthread_future_t future,
+				     uthread_then_func_t func, void *arg,
+				     int flags)
+{
+	struct continuation *cont;
+	uthread_future_t next;
+
+	if (!future || !func)
+	{
+		return NULL;
+	}
+
+	next = uthread_future_create();
+	cont = pool_alloc(sizeof(struct continuation));
+	if (!next || !cont)
+	{
+		uthread_future_destroy(next);
+		pool_free(cont);
+		return NULL;
+	}
+	cont->func = func;
+	cont->arg = arg;
+	cont->flags = flags;
+	cont->next = next;
+
+	preempt_disable();
+	if (!future->set)
+	{
+		/* Wait for the value, uthread_future_set() will start it */
+		queue_enqueue(future->continuations, cont);
+		preempt_enable();
+		return next;
+	}
+	preempt_enable();
+
+	continuation_start(cont, future->value);
+	return next;
+}
@@ -0,0 +1,101 @@
+#ifndef _FUTURE_H
+#define _FUTURE_H
+
+/*
+ * uthread_future_t - Future type
+ *
+ * A future holds a value that is not known yet. It is set exactly once by a
+ * producer thread with uthread_future_set(), and threads calling
+ * uthread_future_get() are blocked until then.
+ *
+ * Continuations can be chained with uthread_future_then(): they are run once
+ * the value is set, and their result sets another future. Continuations do not
+ * get their own thread, so a chain of asynchronous stages does not cost one
+ * stack per stage.
+ */
+typedef struct future *uthread_future_t;
+
+/*
+ * uthread_then_func_t - Continuation function type
+ * @value: Value of the future the continuation was chained to
+ * @arg: Argument given to uthread_future_then()
+ *
+ * Return: Value used to set the future returned by uthread_future_then()
+ */
+typedef void *(*uthread_then_func_t)(void *value, void *arg);
+
+/*
+ * Continuation scheduling
+ *
+ * UTHREAD_THEN_INLINE: the continuation is run right away by the thread
+ * setting the future (or by the thread calling uthread_future_then() if the
+ * future is already set).
+ *
+ * UTHREAD_THEN_DEFERRED: the continuation is spawned as a task (see task.h)
+ * and run later, without creating a new thread unless it blocks.
+ */
+#define UTHREAD_THEN_INLINE	0
+#define UTHREAD_THEN_DEFERRED	1
+
+/*
+ * uthread_future_create - Create future
+ *
+ * Return: Pointer to an initialized future, not set yet. NULL in case of
+ * failure when allocating the new future.
+ */
+uthread_future_t uthread_future_create(void);
+
+/*
+ * uthread_future_destroy - Deallocate a future
+ * @future: Future to deallocate
+ *
+ * Return: -1 if @future is NULL, or if threads are still waiting on @future or
+ * continuations are still pending on it. 0 if @future was successfully
+ * destroyed.
+ */
+int uthread_future_destroy(uthread_future_t future);
+
+/*
+ * uthread_future_set - Set the value of a future
+ * @future: Future to set
+ * @value: Value of the future
+ *
+ * Release all the threads waiting on @future in a single pass, then run or
+ * schedule the continuations chained to @future, in the order they were added.
+ *
+ * Return: -1 if @future is NULL or was already set. 0 otherwise.
+ */
+int uthread_future_set(uthread_future_t future, void *value);
+
+/*
+ * uthread_future_get - Get the value of a future
+ * @future: Future to get the value of
+ * @value: Address where the value is received
+ *
+ * Block the caller thread until @future is set. Return immediately if it
+ * already is.
+ *
+ * Return: -1 if @future or @value are NULL. 0 otherwise.
+ */
+int uthread_future_get(uthread_future_t future, void **value);
+
+/*
+ * uthread_future_then - Chain a continuation to a future
+ * @future: Future to chain the continuation to
+ * @func: Continuation function
+ * @arg: Argument passed to @func
+ * @flags: UTHREAD_THEN_INLINE or UTHREAD_THEN_DEFERRED
+ *
+ * Once @future is set, @func is called with the value of @future and @arg,
+ * and its return value sets the future returned by this function. This new
+ * future must be destroyed by the caller once it is set and not needed
+ * anymore.
+ *
+ * Return: Future set by @func. NULL if @future or @func are NULL, or in case
+ * of failure when allocating the new future.
+ */
+uthread_future_t uthread_future_then(uthread_future_t future,
+				     uthread_then_func_t func, void *arg,
+				     int flags);
+
+#endif /* _FUTURE_H */
@@ -0,0 +1,170 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "barrier.h"
+#include "parallel.h"
+#include "private.h"
+#include "uthread.h"
+
+/* Maximum number of helper threads started by a parallel loop */
+#define PARALLEL_HELPERS 3
+
+struct parallel_job
+{
+	size_t next;
+	size_t end;
+	size_t grain;
+	uthread_range_func_t range_fn;
+	uthread_reduce_func_t reduce_fn;
+	uthread_combine_func_t combine_fn;
+	void *ctx;
+	int64_t result;
+	uthread_waitgroup_t wg;
+};
+
+/*
+ * Claim the next chunk of @job. Chunks are handed out from a shared cursor,
+ * so a thread that gets descheduled simply stops claiming and the others take
+ * over the rest of the range.
+ *
+ * Return: 0 if a chunk was claimed in [@lo, @hi), -1 if the range is done
+ */
+static int job_claim(struct parallel_job *job, size_t *lo, size_t *hi)
+{
+	int retval = -1;
+
+	preempt_disable();
+	if (job->next < job->end)
+	{
+		*lo = job->next;
+		*hi = job->end - *lo > job->grain ? *lo + job->grain : job->end;
+		job->next = *hi;
+		retval = 0;
+	}
+	preempt_enable();
+
+	return retval;
+}
+
+/* Run chunks of @job until there are none left */
+static void job_run(struct parallel_job *job)
+{
+	size_t lo, hi;
+	int64_t partial;
+
+	while (job_claim(job, &lo, &hi) == 0)
+	{
+		if (job->range_fn)
+		{
+			job->range_fn(lo, hi, job->ctx);
+			continue;
+		}
+
+		partial = job->reduce_fn(lo, hi, job->ctx);
+
+		preempt_disable();
+		job->result = job->combine_fn(job->result, partial, job->ctx);
+		preempt_enable();
+	}
+}
+
+static void job_helper(void *arg)
+{
+	struct parallel_job *job = (struct parallel_job *)arg;
+
+	job_run(job);
+	uthread_waitgroup_done(job->wg);
+}
+
+/* Run @job on the caller thread, with helpers if there is more than 1 chunk */
+static void job_start(struct parallel_job *job)
+{
+	size_t chunks, helpers, i;
+
+	/* Empty range */
+	if (job->next >= job->end)
+	{
+		return;
+	}
+
+	chunks = (job->end - job->next - 1) / job->grain + 1;
+	helpers = chunks - 1;
+	if (chunks == 1)
+	{
+		job_run(job);
+		return;
+	}
+
+	if (helpers > PARALLEL_HELPERS)
+	{
+		helpers = PARALLEL_HELPERS;
+	}
+
+	/* Without helpers, the caller runs the whole range on its own */
+	job->wg = uthread_waitgroup_create();
+	if (!job->wg)
+	{
+		job_run(job);
+		return;
+	}
+
+	uthread_waitgroup_add(job->wg, helpers);
+	for (i = 0; i < helpers; i++)
+	{
+		/* A helper that cannot be created leaves its share to the others */
+		if (uthread_create(job_helper, job) != 0)
+		{
+			uthread_waitgroup_done(job->wg);
+		}
+	}
+
+	job_run(job);
+	uthread_waitgroup_wait(job->wg);
+	uthread_waitgroup_destroy(job->wg);
+}
+
+int uthread_parallel_for(size_t begin, size_t end, size_t grain,
+			 uthread_range_func_t fn, void *ctx)
+{
+	struct parallel_job job = {0};
+
+	if (!fn || grain == 0)
+	{
+		return -1;
+	}
+
+	job.next = begin;
+	job.end = end;
+	job.grain = grain;
+	job.range_fn = fn;
+	job.ctx = ctx;
+
+	job_start(&job);
+	return 0;
+}
+
+int uthread_parallel_reduce(size_t begin, size_t end, size_t grain,
+			    int64_t identity, uthread_reduce_func_t fn,
+			    uthread_combine_func_t combine, void *ctx,
+			    int64_t *result)
+{
+	struct parallel_job job = {0};
+
+	if (!fn || !combine || !result || grain == 0)
+	{
+		return -1;
+	}
+
+	job.next = begin;
+	job.end = end;
+	job.grain = grain;
+	job.reduce_fn = fn;
+	job.combine_fn = combine;
+	job.ctx = ctx;
+	job.result = identity;
+
+	job_start(&job);
+	*result = job.result;
+	return 0;
+}
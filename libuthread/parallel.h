@@ -0,0 +1,88 @@
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * uthread_range_func_t - Range function type
+ * @begin: First index of the chunk
+ * @end: Index following the last index of the chunk
+ * @ctx: Context given to uthread_parallel_for()
+ *
+ * Function run by uthread_parallel_for() on each chunk of the range.
+ */
+typedef void (*uthread_range_func_t)(size_t begin, size_t end, void *ctx);
+
+/*
+ * uthread_reduce_func_t - Reduce function type
+ * @begin: First index of the chunk
+ * @end: Index following the last index of the chunk
+ * @ctx: Context given to uthread_parallel_reduce()
+ *
+ * Function run by uthread_parallel_reduce() on each chunk of the range.
+ *
+ * Return: Partial result of the chunk
+ */
+typedef int64_t (*uthread_reduce_func_t)(size_t begin, size_t end, void *ctx);
+
+/*
+ * uthread_combine_func_t - Combine function type
+ * @a: First partial result
+ * @b: Second partial result
+ * @ctx: Context given to uthread_parallel_reduce()
+ *
+ * Function used by uthread_parallel_reduce() to combine two partial results.
+ * Partial results may be combined in any order, so the function must be
+ * associative and commutative.
+ *
+ * Return: Combination of @a and @b
+ */
+typedef int64_t (*uthread_combine_func_t)(int64_t a, int64_t b, void *ctx);
+
+/*
+ * uthread_parallel_for - Run a function over a range of indexes
+ * @begin: First index of the range
+ * @end: Index following the last index of the range
+ * @grain: Number of indexes per chunk
+ * @fn: Function to run on each chunk
+ * @ctx: Context passed to @fn
+ *
+ * Split the range [@begin, @end) into chunks of @grain indexes (the last chunk
+ * may be smaller) and call @fn once per chunk. Chunks are claimed one at a
+ * time by the caller thread and a small, fixed number of helper threads, so
+ * that the number of threads created does not depend on the size of the range.
+ * If the caller is preempted, helpers pick up the remaining chunks.
+ *
+ * This function must be called from a thread, and returns once @fn has been
+ * run on all the chunks.
+ *
+ * Return: -1 if @fn is NULL or @grain is 0. 0 otherwise.
+ */
+int uthread_parallel_for(size_t begin, size_t end, size_t grain,
+			 uthread_range_func_t fn, void *ctx);
+
+/*
+ * uthread_parallel_reduce - Reduce a range of indexes
+ * @begin: First index of the range
+ * @end: Index following the last index of the range
+ * @grain: Number of indexes per chunk
+ * @identity: Identity value of @combine
+ * @fn: Function computing the partial result of a chunk
+ * @combine: Function combining two partial results
+ * @ctx: Context passed to @fn and @combine
+ * @result: Address where the final result is received
+ *
+ * Split the range like uthread_parallel_for(), compute the partial result of
+ * each chunk with @fn and combine them all with @combine, starting from
+ * @identity.
+ *
+ * Return: -1 if @fn, @combine or @result are NULL, or if @grain is 0. 0
+ * otherwise.
+ */
+int uthread_parallel_reduce(size_t begin, size_t end, size_t grain,
+			    int64_t identity, uthread_reduce_func_t fn,
+			    uthread_combine_func_t combine, void *ctx,
+			    int64_t *result);
+
+#endif /* _PARALLEL_H */
@@ -0,0 +1,342 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "pool.h"
+#include "private.h"
+
+/* Objects are multiples of this size */
+#define POOL_ALIGN 16
+
+/* Number of size classes, one every POOL_ALIGN bytes */
+#define POOL_CLASSES (POOL_MAX_SIZE / POOL_ALIGN)
+
+/*
+ * Size of the slabs that the pools carve their objects from, which are also
+ * aligned on this size so that an object finds its slab by masking its address
+ */
+#define POOL_SLAB_SIZE 16384
+
+/*
+ * Number of slabs allocated at once, so that they are not scattered among the
+ * other allocations (e.g., stacks) by the alignment
+ */
+#define POOL_BLOCK_SLABS 64
+
+/* Initial capacity of the list of released slabs */
+#define POOL_RELEASED_SIZE 64
+
+struct pool;
+
+/* Free object, the link lives in the object itself */
+struct pool_object
+{
+	struct pool_object *next;
+};
+
+/*
+ * Header of every slab, telling the pool its objects belong to. Apart from
+ * @pool, the fields are only touched by the kernel thread owning the pool.
+ */
+union pool_slab
+{
+	struct
+	{
+		struct pool *pool;
+		struct pool_object *free;
+		size_t live;
+		union pool_slab *prev;
+		union pool_slab *next;
+	};
+	char align[POOL_CACHE_LINE];
+};
+
+struct pool
+{
+	union pool_slab *partial;
+	struct pool_object *remote;
+	size_t size;
+};
+
+/*
+ * Pools of the calling kernel thread, one per size class. They are allocated
+ * on first use and never freed, as other kernel threads may still return
+ * objects to them after the thread exits.
+ */
+static __thread struct pool *pools;
+
+/* Slabs of the calling kernel thread not given to a pool yet */
+static __thread char *slabs;
+static __thread size_t slabs_left;
+
+/*
+ * Slabs of the calling kernel thread whose memory was given back to the kernel,
+ * kept to be reused before new ones are carved
+ */
+static __thread union pool_slab **released;
+static __thread size_t released_count;
+static __thread size_t released_size;
+
+/* Allocate a slab of its own for an object of @size bytes */
+static union pool_slab *pool_slab_alloc(size_t size)
+{
+	union pool_slab *slab;
+
+	size = (sizeof(union pool_slab) + size + POOL_SLAB_SIZE - 1) / POOL_SLAB_SIZE * POOL_SLAB_SIZE;
+	slab = aligned_alloc(POOL_SLAB_SIZE, size);
+	if (slab)
+	{
+		slab->pool = NULL;
+	}
+	return slab;
+}
+
+/* Slab of @ptr, an object given by pool_alloc() */
+static union pool_slab *pool_slab(void *ptr)
+{
+	return (union pool_slab *)((uintptr_t)ptr & ~(uintptr_t)(POOL_SLAB_SIZE - 1));
+}
+
+/* Add @slab to the slabs of @pool with free objects */
+static void pool_link(struct pool *pool, union pool_slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = pool->partial;
+	if (pool->partial)
+	{
+		pool->partial->prev = slab;
+	}
+	pool->partial = slab;
+}
+
+static void pool_unlink(struct pool *pool, union pool_slab *slab)
+{
+	if (slab->prev)
+	{
+		slab->prev->next = slab->next;
+	}
+	else
+	{
+		pool->partial = slab->next;
+	}
+	if (slab->next)
+	{
+		slab->next->prev = slab->prev;
+	}
+}
+
+/*
+ * Give the memory of @slab, whose objects are all free, back to the kernel. The
+ * slab keeps its address range, to be reused by the next refill.
+ */
+static bool pool_slab_release(union pool_slab *slab)
+{
+	union pool_slab **list;
+	size_t size;
+
+	if (released_count == released_size)
+	{
+		size = released_size ? released_size * 2 : POOL_RELEASED_SIZE;
+		list = realloc(released, size * sizeof(union pool_slab *));
+		if (!list)
+		{
+			return false;
+		}
+		released = list;
+		released_size = size;
+	}
+
+	if (madvise(slab, POOL_SLAB_SIZE, MADV_DONTNEED) != 0)
+	{
+		return false;
+	}
+	released[released_count++] = slab;
+	return true;
+}
+
+/* Carve a new slab into free objects for @pool, and link it to the pool */
+static union pool_slab *pool_refill(struct pool *pool)
+{
+	size_t count = (POOL_SLAB_SIZE - sizeof(union pool_slab)) / pool->size;
+	union pool_slab *slab;
+	struct pool_object *object;
+	size_t i;
+
+	if (released_count > 0)
+	{
+		slab = released[--released_count];
+	}
+	else
+	{
+		if (slabs_left == 0)
+		{
+			slabs = aligned_alloc(POOL_SLAB_SIZE, POOL_BLOCK_SLABS * POOL_SLAB_SIZE);
+			if (!slabs)
+			{
+				return NULL;
+			}
+			slabs_left = POOL_BLOCK_SLABS;
+		}
+		slab = (union pool_slab *)slabs;
+		slabs += POOL_SLAB_SIZE;
+		slabs_left--;
+	}
+	slab->pool = pool;
+	slab->free = NULL;
+	slab->live = 0;
+
+	/* Chain the objects backwards, so that they are given in address order */
+	for (i = count; i-- > 0;)
+	{
+		object = (struct pool_object *)((char *)(slab + 1) + i * pool->size);
+		object->next = slab->free;
+		slab->free = object;
+	}
+
+	pool_link(pool, slab);
+	return slab;
+}
+
+/*
+ * Return @object to its @slab of @pool, from the kernel thread owning the pool.
+ * A slab whose objects are all free is given back to the kernel, unless it is
+ * the only one of the pool with free objects, which keeps a thread allocating
+ * and freeing one object from releasing and refilling the same slab.
+ */
+static void pool_put(struct pool *pool, union pool_slab *slab, struct pool_object *object)
+{
+	if (!slab->free)
+	{
+		pool_link(pool, slab);
+	}
+	object->next = slab->free;
+	slab->free = object;
+
+	if (--slab->live == 0 && (slab->prev || slab->next))
+	{
+		pool_unlink(pool, slab);
+		if (!pool_slab_release(slab))
+		{
+			pool_link(pool, slab);
+		}
+	}
+}
+
+void *pool_alloc(size_t size)
+{
+	union pool_slab *slab;
+	struct pool_object *object;
+	struct pool_object *next;
+	struct pool *pool;
+	size_t i;
+
+	size = (size + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+	if (size == 0)
+	{
+		size = POOL_ALIGN;
+	}
+
+	/* Large objects get a slab of their own, without a pool */
+	if (size > POOL_MAX_SIZE)
+	{
+		if (size > SIZE_MAX - 2 * POOL_SLAB_SIZE)
+		{
+			return NULL;
+		}
+		preempt_defer_begin();
+		slab = pool_slab_alloc(size);
+		preempt_defer_end();
+		return slab ? slab + 1 : NULL;
+	}
+
+	preempt_defer_begin();
+	if (!pools)
+	{
+		pools = malloc(POOL_CLASSES * sizeof(struct pool));
+		if (!pools)
+		{
+			preempt_defer_end();
+			return NULL;
+		}
+		for (i = 0; i < POOL_CLASSES; i++)
+		{
+			pools[i].partial = NULL;
+			pools[i].remote = NULL;
+			pools[i].size = (i + 1) * POOL_ALIGN;
+		}
+	}
+	pool = &pools[size / POOL_ALIGN - 1];
+	if (!pool->partial)
+	{
+		/* Take back all the objects freed by other kernel threads at once */
+		object = __atomic_exchange_n(&pool->remote, NULL, __ATOMIC_ACQUIRE);
+		while (object)
+		{
+			next = object->next;
+			pool_put(pool, pool_slab(object), object);
+			object = next;
+		}
+	}
+	slab = pool->partial;
+	if (!slab)
+	{
+		slab = pool_refill(pool);
+		if (!slab)
+		{
+			preempt_defer_end();
+			return NULL;
+		}
+	}
+
+	object = slab->free;
+	slab->free = object->next;
+	slab->live++;
+	if (!slab->free)
+	{
+		pool_unlink(pool, slab);
+	}
+	preempt_defer_end();
+
+	return object;
+}
+
+void pool_free(void *ptr)
+{
+	union pool_slab *slab;
+	struct pool_object *object = ptr;
+	struct pool *pool;
+
+	if (!ptr)
+	{
+		return;
+	}
+
+	slab = pool_slab(ptr);
+	pool = slab->pool;
+	if (!pool)
+	{
+		preempt_defer_begin();
+		free(slab);
+		preempt_defer_end();
+		return;
+	}
+
+	if (pools && pool >= pools && pool < pools + POOL_CLASSES)
+	{
+		/* Freed by its owner */
+		preempt_defer_begin();
+		pool_put(pool, slab, object);
+		preempt_defer_end();
+		return;
+	}
+
+	/* Freed by another kernel thread, the owner takes it back later */
+	object->next = __atomic_load_n(&pool->remote, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&pool->remote, &object->next, object,
+					    true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	{
+		continue;
+	}
+}
@@ -0,0 +1,59 @@
+#ifndef _UTHREAD_POOL_H
+#define _UTHREAD_POOL_H
+
+/*
+ * This header is only meant to be included by files from the libuthread. It
+ * defines the object pools that the library allocates its small objects from
+ * (TCBs, queue nodes, semaphores, ...) instead of malloc().
+ *
+ * Every kernel thread (the worker, or a thread calling uthread_submit()) owns
+ * a pool per size class, only touched by itself. An object freed by the thread
+ * that allocated it goes back to the local free list of its pool; an object
+ * freed by another kernel thread is pushed on the remote free list of its
+ * pool, with a single atomic operation, and the owner takes the whole remote
+ * list back at once when its local list runs out.
+ *
+ * Objects are carved from slabs aligned on their size, which start with a
+ * cache line naming their pool, so objects carry no header and the ones whose
+ * size is a multiple of POOL_CACHE_LINE are aligned on a cache line.
+ *
+ * Every slab keeps its own free list and counts its objects in use. Once all
+ * the objects of a slab are back (and the pool has another slab with free
+ * objects), its memory is given back to the kernel with madvise(), so that the
+ * memory taken by a burst of threads is returned once they exit. The address
+ * range of the slab is kept and reused first. Objects freed by another kernel
+ * thread only count once the owner takes them back.
+ *
+ * Arrays that grow as a whole (the task ring, the timer heap, the file
+ * descriptor waiters and their poll array, the TLS overflow tables) and the
+ * buffers of the debugging tools (profile samples, trace and profile reports)
+ * still come from malloc(), as do heap stacks and arena chunks.
+ */
+
+#include <stddef.h>
+
+/* Size of a cache line (in bytes) */
+#define POOL_CACHE_LINE 64
+
+/* Largest object served by the pools (in bytes), larger ones get a slab each */
+#define POOL_MAX_SIZE 4096
+
+/*
+ * pool_alloc - Allocate an object
+ * @size: Size of the object (in bytes)
+ *
+ * Safe with preemption enabled: preemption is held off while the pool of the
+ * calling kernel thread is updated, without a system call.
+ *
+ * Return: Pointer to the object, aligned for any type and on a cache line if
+ * @size is a multiple of POOL_CACHE_LINE, or NULL in case of failure
+ */
+void *pool_alloc(size_t size);
+
+/*
+ * pool_free - Free an object
+ * @ptr: Object given by pool_alloc(), from any kernel thread, or NULL
+ */
+void pool_free(void *ptr);
+
+#endif /* _UTHREAD_POOL_H */
@@ -1,10 +1,13 @@
+#define _GNU_SOURCE
 #include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "private.h"
 #include "uthread.h"
@@ -15,9 +18,31 @@
  */
 #define HZ 100
 
+/* Not named by glibc before 2.39 */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
 struct sigaction sa;
 sigset_t ss;
-struct itimerval timer;
+struct itimerspec timer;
+
+/*
+ * Timer counting the CPU time of the worker, whose signal is sent to the worker
+ * alone: a process-wide timer (e.g., ITIMER_VIRTUAL) may signal any kernel
+ * thread, such as one calling uthread_submit()
+ */
+static timer_t preempt_timer;
+
+/* Whether preemption was started, the other functions are no-ops otherwise */
+static bool preempt_active;
+
+/* Whether the calling kernel thread is the worker that started preemption */
+static __thread volatile sig_atomic_t preempt_worker;
+
+/* Nesting depth of preempt_defer_begin(), and whether a preemption was deferred */
+static __thread volatile sig_atomic_t preempt_defer_depth;
+static __thread volatile sig_atomic_t preempt_deferred;
 
 /* Pass this as signal handler */
 void sig_handler(int dummy)
@@ -25,12 +50,47 @@ void sig_handler(int dummy)
 	/* Do nothing with this value, handles the int warning */
 	(void)dummy;
 
-	uthread_yield();
+	/*
+	 * Only the worker runs threads. A SIGVTALRM sent to the whole process
+	 * (e.g., by kill) may land on another kernel thread, ignore it there.
+	 */
+	if (!preempt_worker)
+	{
+		return;
+	}
+
+	/* Preempt once the deferring section is over */
+	if (preempt_defer_depth > 0)
+	{
+		preempt_deferred = 1;
+		return;
+	}
+
+	uthread_preempt();
+}
+
+void preempt_defer_begin(void)
+{
+	preempt_defer_depth++;
+}
+
+void preempt_defer_end(void)
+{
+	if (--preempt_defer_depth == 0 && preempt_deferred)
+	{
+		preempt_deferred = 0;
+		uthread_preempt();
+	}
 }
 
 /* Helped by sample code of signals section of syscalls lecture */
 void preempt_disable(void)
 {
+	if (!preempt_active)
+	{
+		return;
+	}
+
 	sigemptyset(&ss);
 	sigaddset(&ss, SIGVTALRM);
 	sigprocmask(SIG_BLOCK, &ss, NULL);
@@ -38,6 +98,11 @@ void preempt_disable(void)
 
 void preempt_enable(void)
 {
+	if (!preempt_active)
+	{
+		return;
+	}
+
 	sigemptyset(&ss);
 	sigaddset(&ss, SIGVTALRM);
 	sigprocmask(SIG_UNBLOCK, &ss, NULL);
@@ -45,28 +110,57 @@ void preempt_enable(void)
 
 void preempt_start(bool preempt)
 {
+	struct sigevent sev;
+
+	preempt_active = preempt;
 	if (preempt)
 	{
 		/* Set up handler */
+		preempt_worker = 1;
 		sa.sa_handler = sig_handler;
 		sigemptyset(&sa.sa_mask);
+		/*
+		 * Both timers expire on the same clock tick, so keep a profiling
+		 * sample from landing in this handler rather than in the thread
+		 */
+		sigaddset(&sa.sa_mask, SIGPROF);
 		sa.sa_flags = 0;
 		sigaction(SIGVTALRM, &sa, NULL);
 
+		/* Create a timer on the CPU time of the worker, signaling it only */
+		memset(&sev, 0, sizeof(sev));
+		sev.sigev_notify = SIGEV_THREAD_ID;
+		sev.sigev_signo = SIGVTALRM;
+		sev.sigev_notify_thread_id = gettid();
+		if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &preempt_timer) != 0)
+		{
+			/* Run without preemption rather than not at all */
+			sa.sa_handler = SIG_DFL;
+			sigaction(SIGVTALRM, &sa, NULL);
+			preempt_worker = 0;
+			preempt_active = false;
+			return;
+		}
+
 		/* Configure Timer */
 		timer.it_value.tv_sec = 1 / HZ;
-		timer.it_value.tv_usec = 1000000 / HZ;
+		timer.it_value.tv_nsec = 1000000000 / HZ;
 		timer.it_interval = timer.it_value;
-		setitimer(ITIMER_VIRTUAL, &timer, NULL);
+		timer_settime(preempt_timer, 0, &timer, NULL);
 	}
 }
 
 void preempt_stop(void)
 {
-	/* To stop preemption, we need to stop the timer by setting it_value values to 0 */
-	timer.it_value.tv_sec = 0;
-	timer.it_value.tv_usec = 0;
-	setitimer(ITIMER_VIRTUAL, &timer, NULL);
+	if (!preempt_active)
+	{
+		return;
+	}
+	preempt_active = false;
+
+	/* Deleting the timer stops it, no signal is sent after that */
+	timer_delete(preempt_timer);
+	preempt_worker = 0;
 
 	/* Proceed to then set the handler back */
 	/* SIG_DFL derived from struct sigaction man page */
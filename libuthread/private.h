@@ -12,6 +12,7 @@
  */
 #include <ucontext.h>
 
+#include "queue.h"
 #include "uthread.h"
 
 /*
@@ -34,13 +35,43 @@ typedef ucontext_t uthread_ctx_t;
  */
 void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next);
 
+/*
+ * uthread_ctx_switch_int - Switch from an integer-only execution context
+ * @prev: Pointer to the execution context structure in which to save the
+ *	currently running thread, which does not use floating point
+ * @next: Pointer to the execution context structure to resume
+ * @next_int: Whether @next was saved by this function too
+ *
+ * Only saves the stack, return address and callee-saved integer registers of
+ * the running thread, leaving out its floating point environment and signal
+ * mask, so it must not be called from a signal handler, whose mask differs.
+ * Switching between two such contexts costs no system call, and keeps the
+ * signal mask of the caller. A context saved here can still be resumed by
+ * uthread_ctx_switch() once given the signal mask to resume with, and the
+ * other way around, with @next_int false.
+ */
+void uthread_ctx_switch_int(uthread_ctx_t *prev, uthread_ctx_t *next, bool next_int);
+
+/*
+ * UTHREAD_STACK_SIZE - Default size of the stack segments allocated by
+ * uthread_ctx_alloc_stack() (in bytes)
+ */
+#define UTHREAD_STACK_SIZE 32768
+
+/*
+ * UTHREAD_LAZY_STACK_SIZE - Default size of the stack segments reserved by
+ * uthread_ctx_map_stack() (in bytes)
+ */
+#define UTHREAD_LAZY_STACK_SIZE (1024 * 1024)
+
 /*
  * uthread_ctx_alloc_stack - Allocate stack segment
+ * @size: Size of the stack segment (in bytes)
  *
  * Return: Pointer to the top of a valid stack segment, or NULL in case of
  * failure
  */
-void *uthread_ctx_alloc_stack(void);
+void *uthread_ctx_alloc_stack(size_t size);
 
 /*
  * uthread_ctx_destroy_stack - Deallocate stack segment
@@ -48,19 +79,248 @@ void *uthread_ctx_alloc_stack(void);
  */
 void uthread_ctx_destroy_stack(void *top_of_stack);
 
+/*
+ * uthread_ctx_map_stack - Reserve a lazily committed stack segment
+ * @size: Size of the stack segment (in bytes), multiple of the page size
+ *
+ * Map a stack segment of @size bytes, preceded by a guard page. The memory is
+ * reserved but not committed: pages are only backed by physical memory once
+ * touched, so large stacks cost nothing until they are actually used.
+ *
+ * Return: Pointer to the top of a valid stack segment, or NULL in case of
+ * failure
+ */
+void *uthread_ctx_map_stack(size_t size);
+
+/*
+ * uthread_ctx_map_stacks - Reserve lazily committed stack segments at once
+ * @count: Number of stack segments
+ * @size: Size of each stack segment (in bytes), multiple of the page size
+ *
+ * Same as @count calls to uthread_ctx_map_stack(), with a single mapping. The
+ * stack segment i starts at the returned pointer plus i * (@size + page size),
+ * and is unmapped on its own with uthread_ctx_unmap_stack().
+ *
+ * Return: Pointer to the top of the first stack segment, or NULL in case of
+ * failure
+ */
+void *uthread_ctx_map_stacks(size_t count, size_t size);
+
+/*
+ * uthread_ctx_unmap_stack - Unmap stack segment
+ * @top_of_stack: Address of stack to unmap, as returned by
+ *	uthread_ctx_map_stack()
+ * @size: Size of the stack segment given to uthread_ctx_map_stack()
+ */
+void uthread_ctx_unmap_stack(void *top_of_stack, size_t size);
+
+/*
+ * UTHREAD_HUGE_ARENA_SIZE - Size of the arenas that uthread_ctx_alloc_huge_stack()
+ * carves stacks from, that of a huge page (in bytes)
+ */
+#define UTHREAD_HUGE_ARENA_SIZE (2 * 1024 * 1024)
+
+/*
+ * uthread_ctx_alloc_huge_stack - Allocate a stack segment backed by huge pages
+ * @size: Size of the stack segment (in bytes), multiple of the page size and
+ *	at most UTHREAD_HUGE_ARENA_SIZE minus a page
+ *
+ * Stack segments are carved from arenas of UTHREAD_HUGE_ARENA_SIZE bytes,
+ * each backed by a single huge page, so that switching between the threads
+ * of an arena does not miss in the TLB. Arenas use explicit huge pages when
+ * the system has some reserved (see /proc/sys/vm/nr_hugepages), and otherwise
+ * ask for transparent huge pages. Stack segments have no guard page, which
+ * would split the huge page. Must be called with preemption disabled.
+ *
+ * Return: Pointer to the top of a valid stack segment, or NULL in case of
+ * failure, including when no huge page can back a new arena
+ */
+void *uthread_ctx_alloc_huge_stack(size_t size);
+
+/*
+ * uthread_ctx_huge_pages - Check whether huge pages can back stack arenas
+ *
+ * Return: True if the system has explicit huge pages reserved, or transparent
+ * huge pages enabled (see /sys/kernel/mm/transparent_hugepage/enabled)
+ */
+bool uthread_ctx_huge_pages(void);
+
+/*
+ * uthread_ctx_free_huge_stack - Deallocate a stack segment backed by huge pages
+ * @top_of_stack: Address of stack to deallocate, as returned by
+ *	uthread_ctx_alloc_huge_stack()
+ *
+ * Must be called with preemption disabled.
+ */
+void uthread_ctx_free_huge_stack(void *top_of_stack);
+
+/*
+ * uthread_ctx_stack_pointer - Get the stack pointer saved in a context
+ * @uctx: Context of a thread that is not running
+ *
+ * Return: Stack pointer of @uctx, or NULL if not supported on the architecture
+ */
+void *uthread_ctx_stack_pointer(const uthread_ctx_t *uctx);
+
+/*
+ * uthread_ctx_stack_resident - Get the resident memory of a stack segment
+ * @start: Lowest address of the range
+ * @end: Address past the end of the range
+ * @lowest: Address where the lowest resident page is received, or NULL if
+ *	none is resident
+ *
+ * Return: Number of resident bytes in the pages spanned by the range
+ */
+size_t uthread_ctx_stack_resident(void *start, void *end, void **lowest);
+
+/*
+ * uthread_ctx_release_stack - Give the unused part of a stack segment back
+ * @top_of_stack: Pointer to the top of the stack segment
+ * @sp: Stack pointer of the thread using the segment, which is not running
+ *
+ * The whole pages of the segment below @sp (and below the red zone the ABI
+ * lets functions use beneath it) are given back to the kernel with
+ * madvise(MADV_DONTNEED), and read as zeros when touched again.
+ *
+ * Return: Number of resident bytes given back
+ */
+size_t uthread_ctx_release_stack(void *top_of_stack, void *sp);
+
 /*
  * uthread_ctx_init - Initialize a thread's execution context
  * @uctx: Pointer to thread context to initialize
  * @top_of_stack: Pointer to the top of a valid stack segment, as allocated by
- *	uthread_ctx_alloc_stack()
+ *	uthread_ctx_alloc_stack() or uthread_ctx_map_stack()
+ * @size: Size of the stack segment (in bytes)
  * @func: Function to be executed by the thread
  * @arg: Argument to pass to the thread
  *
  * Return: 0 if @uctx was properly initialized, or -1 in case of failure
  */
-int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
+int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack, size_t size,
 					 uthread_func_t func, void *arg);
 
+/*
+ * uthread_ctx_init_from - Initialize a thread's execution context from another
+ * @uctx: Pointer to thread context to initialize
+ * @model: Context saved with getcontext() by the calling thread
+ * @top_of_stack: Pointer to the top of a valid stack segment
+ * @size: Size of the stack segment (in bytes)
+ * @func: Function to be executed by the thread
+ * @arg: Argument to pass to the thread
+ *
+ * Same as uthread_ctx_init(), but starts from @model rather than from the
+ * current context, to initialize many contexts at a lower cost.
+ *
+ * Return: 0 if @uctx was properly initialized, or -1 in case of failure
+ */
+int uthread_ctx_init_from(uthread_ctx_t *uctx, const uthread_ctx_t *model,
+			  void *top_of_stack, size_t size,
+			  uthread_func_t func, void *arg);
+
+
+/**
+ * Private event API
+ */
+
+/*
+ * event_init - Create the eventfd waking the idle thread up
+ *
+ * Return: 0 in case of success, -1 in case of failure
+ */
+int event_init(void);
+
+/*
+ * event_destroy - Release the resources of the event module
+ */
+void event_destroy(void);
+
+/*
+ * event_waiting - Tell whether threads are sleeping or waiting for I/O
+ *
+ * Return: true if some thread waits on a timer or a file descriptor
+ */
+bool event_waiting(void);
+
+/*
+ * event_poll - Wake the threads whose timer expired or whose file is ready
+ *
+ * Never blocks. Timers are checked on every call, file descriptors at most
+ * once per millisecond. Must be called with preemption disabled.
+ */
+void event_poll(void);
+
+/*
+ * event_wait - Sleep until a thread can be woken up
+ * @deadline: Time at which to stop sleeping in any case, as given by
+ *	uthread_clock_ns(), or 0 for none
+ *
+ * Called by the idle thread when no thread is ready: sleeps in the kernel until
+ * the next timer expires, a file descriptor is ready, a function is submitted
+ * or @deadline passes, then wakes the corresponding threads up.
+ *
+ * Return: 0 after sleeping, -1 if nothing could ever wake a thread up (no
+ * timer, no file descriptor, no hold and no pending submission)
+ */
+int event_wait(uint64_t deadline);
+
+/*
+ * event_close - Stop taking submissions
+ *
+ * Called by the idle thread once no thread can be woken up anymore: from then
+ * on, uthread_submit() fails. Waits for the kernel threads still submitting,
+ * and creates a thread for every function they submitted after the idle thread
+ * last looked, so that no submission that succeeded is lost. If there were
+ * any, the run goes on and submissions are taken again.
+ *
+ * Return: 0 if threads were created for late submissions, in which case
+ * submissions are open again, -1 otherwise
+ */
+int event_close(void);
+
+/*
+ * event_block_timeout - Block the running thread until woken up or a deadline
+ * @ns: Time until the deadline (in nanoseconds)
+ * @expire: Function called if the deadline passes first, or NULL
+ * @arg: Argument to be passed to @expire
+ *
+ * Must be called with preemption disabled, which it leaves disabled. When the
+ * deadline passes before another thread wakes the running thread up, @expire
+ * is called right before the thread is made ready, e.g., to take it out of the
+ * waiting list it was in.
+ *
+ * Return: 0 if woken up before the deadline, 1 if the deadline passed, -1 in
+ * case of failure (e.g., memory allocation), in which case it did not block
+ */
+int event_block_timeout(uint64_t ns, void (*expire)(void *arg), void *arg);
+
+/**
+ * Private worker placement API
+ */
+
+/*
+ * worker_start - Apply the placement of the worker
+ *
+ * Pin the calling kernel thread, which becomes the worker, to the CPU given to
+ * uthread_set_worker_placement(), if any.
+ *
+ * Return: 0 in case of success, -1 if the worker cannot be pinned
+ */
+int worker_start(void);
+
+/*
+ * worker_stop - Restore the affinity the worker had before worker_start()
+ */
+void worker_stop(void);
+
+/*
+ * worker_bind - Bind memory to the NUMA node of the worker
+ * @addr: Start of the memory, aligned on a page
+ * @len: Length of the memory (in bytes)
+ *
+ * Does nothing unless a node was given to uthread_set_worker_placement().
+ */
+void worker_bind(void *addr, size_t len);
 
 /**
  * Private preemption API
@@ -70,8 +330,10 @@ int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
  * preempt_start - Start thread preemption
  * @preempt: Enable preemption if true
  *
- * Configure a timer that must fire a virtual alarm at a frequency of 100 Hz and
+ * Configure a timer that sends a virtual alarm to the calling kernel thread
+ * (the worker) every 10 ms of its CPU time, i.e. at 100 Hz while it runs, and
  * setup a timer handler that forcefully yields the currently running thread.
+ * The other kernel threads of the process are never signaled.
  *
  * If @preempt is false, don't start preemption; all the other functions from
  * the preemption API should then be ineffective.
@@ -96,6 +358,21 @@ void preempt_enable(void);
  */
 void preempt_disable(void);
 
+/*
+ * preempt_defer_begin - Defer preemption without a system call
+ *
+ * Unlike preempt_disable(), this only increments a counter, and can be nested.
+ * A timer signal landing before the matching preempt_defer_end() is recorded,
+ * and the thread is preempted by preempt_defer_end() instead. Meant for short
+ * sections that may run with preemption either enabled or disabled.
+ */
+void preempt_defer_begin(void);
+
+/*
+ * preempt_defer_end - End a section started by preempt_defer_begin()
+ */
+void preempt_defer_end(void);
+
 
 /**
  * Private uthread API
@@ -114,15 +391,114 @@ struct uthread_tcb;
  */
 struct uthread_tcb *uthread_current(void);
 
+/*
+ * uthread_id - Get the identifier of a thread
+ * @uthread: TCB of the thread
+ *
+ * Return: Identifier of @uthread, 0 for the idle thread. Identifiers are given
+ * in creation order and are not reused.
+ */
+uint32_t uthread_id(struct uthread_tcb *uthread);
+
+/*
+ * uthread_arena - Get the arena of the running thread
+ *
+ * Return: Address of the list of arena chunks of the running thread, NULL
+ * outside of uthread_run()
+ */
+struct arena_chunk **uthread_arena(void);
+
+/*
+ * arena_free - Free all the chunks of an arena
+ * @arena: Address of the list of arena chunks, left empty
+ *
+ * Must be called with preemption disabled.
+ */
+void arena_free(struct arena_chunk **arena);
+
+/*
+ * uthread_create_locked - Create a new thread with preemption disabled
+ * @handle: Set to the handle of the new thread if not NULL
+ * @attr: Attributes of the new thread, NULL for the defaults
+ * @func: Function to be executed by the thread
+ * @arg: Argument to be passed to the thread
+ *
+ * Same as uthread_create_attr(), but must be called with preemption disabled,
+ * which it leaves disabled, so that the new thread cannot run before the
+ * caller is done.
+ *
+ * Return: 0 in case of success, -1 in case of failure
+ */
+int uthread_create_locked(uthread_t *handle, const uthread_attr_t *attr,
+			  uthread_func_t func, void *arg);
+
+/*
+ * uthread_preempt - Preempt currently running thread
+ *
+ * Same as uthread_yield(), called from the timer signal handler so that
+ * forced switches can be told apart from voluntary ones.
+ */
+void uthread_preempt(void);
+
 /*
  * uthread_block - Block currently running thread
  */
 void uthread_block(void);
 
+/*
+ * uthread_wake - Make a blocked thread ready
+ * @uthread: TCB of thread to wake up
+ *
+ * Same as uthread_unblock(), but must be called with preemption disabled,
+ * which it leaves disabled, and @uthread goes to the back of the ready queue.
+ * A thread that is not blocked is left alone.
+ *
+ * Return: true if @uthread was blocked and is now ready, false otherwise
+ */
+bool uthread_wake(struct uthread_tcb *uthread);
+
 /*
  * uthread_unblock - Unblock thread
  * @uthread: TCB of thread to unblock
+ *
+ * @uthread runs next, before the other threads of its priority level, unless
+ * another thread is unblocked first or a streak of threads ran this way. A
+ * thread that is not blocked is left alone, as with uthread_wake().
  */
 void uthread_unblock(struct uthread_tcb *uthread);
 
+/*
+ * uthread_unblock_all - Unblock all the threads of a waiting list
+ * @waiters: Queue of TCBs of blocked threads
+ *
+ * Same as calling uthread_unblock() on every thread of @waiters, from the
+ * oldest to the newest, but the whole list is moved to the back of the ready
+ * queue in a single operation. Queue @waiters is left empty.
+ */
+void uthread_unblock_all(queue_t waiters);
+
+/*
+ * uthread_clock_ns - Get the clock used for the thread statistics
+ *
+ * Return: Monotonic time in nanoseconds
+ */
+uint64_t uthread_clock_ns(void);
+
+/*
+ * uthread_account_sem_wait - Add semaphore wait time to the running thread
+ * @ns: Time spent waiting, in nanoseconds
+ */
+void uthread_account_sem_wait(uint64_t ns);
+
+/*
+ * uthread_task_blocked - Notify the task module that a thread blocks or exits
+ * @uthread: TCB of the thread about to block or exit
+ *
+ * If @uthread is carrying tasks (see task.h), the blocking task keeps its
+ * stack, or the exiting task takes the carrier down with it, and another
+ * carrier is started for the pending tasks. Must be called with preemption
+ * disabled.
+ */
+void uthread_task_blocked(struct uthread_tcb *uthread);
+
 #endif /* _UTHREAD_PRIVATE_H */
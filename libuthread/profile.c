@@ -0,0 +1,338 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "private.h"
+#include "profile.h"
+#include "uthread.h"
+
+/* Maximum number of samples, and of frames per sample */
+#define PROFILE_SAMPLES (1 << 16)
+#define PROFILE_DEPTH 32
+
+/* Frames of the signal handler and of the signal trampoline */
+#define PROFILE_SKIP 2
+
+/* Maximum length of a folded stack line */
+#define PROFILE_LINE_LEN 4096
+
+/* Not named by glibc before 2.39 */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+struct profile_sample
+{
+	uint32_t tid;
+	int depth;
+	char name[UTHREAD_NAME_LEN];
+	void *pcs[PROFILE_DEPTH];
+};
+
+/*
+ * Samples taken, and number of slots claimed by the signal handler, which may
+ * exceed the size of the buffer
+ */
+static struct profile_sample *samples;
+static size_t sample_count;
+static bool profiling;
+
+/*
+ * Timer counting the CPU time of the kernel thread that started the profiler,
+ * whose signal is sent to that thread alone: a process-wide timer (e.g.,
+ * ITIMER_PROF) may signal any kernel thread, running no uthread or another one
+ */
+static timer_t profile_timer;
+
+/* Whether the calling kernel thread is the one being profiled */
+static __thread volatile sig_atomic_t profile_worker;
+
+static struct sigaction old_action;
+
+/* Number of samples in the buffer */
+static size_t profile_samples(void)
+{
+	size_t count = __atomic_load_n(&sample_count, __ATOMIC_RELAXED);
+
+	return count < PROFILE_SAMPLES ? count : PROFILE_SAMPLES;
+}
+
+/* Take a sample of the running thread */
+static void profile_handler(int signum)
+{
+	struct uthread_tcb *thread = uthread_current();
+	struct profile_sample *sample;
+	int saved_errno = errno;
+	size_t slot;
+	(void)signum;
+
+	/* A SIGPROF sent to the whole process may land on another kernel thread */
+	if (!profile_worker)
+	{
+		return;
+	}
+
+	slot = __atomic_fetch_add(&sample_count, 1, __ATOMIC_RELAXED);
+	if (slot >= PROFILE_SAMPLES)
+	{
+		return;
+	}
+
+	sample = &samples[slot];
+	sample->depth = backtrace(sample->pcs, PROFILE_DEPTH);
+	if (thread)
+	{
+		sample->tid = uthread_id(thread);
+		strncpy(sample->name, uthread_get_name(thread), UTHREAD_NAME_LEN);
+	}
+	else
+	{
+		/* Sampled outside of uthread_run() */
+		sample->tid = UINT32_MAX;
+		sample->name[0] = '\0';
+	}
+
+	errno = saved_errno;
+}
+
+int uthread_profile_start(unsigned int hz)
+{
+	struct itimerspec timer;
+	struct sigevent sev;
+	struct sigaction sa;
+	void *pc;
+
+	if (profiling)
+	{
+		return -1;
+	}
+
+	if (!samples)
+	{
+		samples = malloc(PROFILE_SAMPLES * sizeof(struct profile_sample));
+		if (!samples)
+		{
+			return -1;
+		}
+	}
+	sample_count = 0;
+
+	/* The first backtrace() loads the unwinder, which is not signal safe */
+	backtrace(&pc, 1);
+
+	/* Hold preemption while a sample is taken */
+	sa.sa_handler = profile_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaddset(&sa.sa_mask, SIGVTALRM);
+	sa.sa_flags = SA_RESTART;
+	if (sigaction(SIGPROF, &sa, &old_action) != 0)
+	{
+		return -1;
+	}
+
+	if (hz == 0)
+	{
+		hz = UTHREAD_PROFILE_HZ;
+	}
+	if (hz > 1000000)
+	{
+		/* A period of 0 would disarm the timer */
+		hz = 1000000;
+	}
+
+	/* Create a timer on the CPU time of the calling thread, signaling it only */
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIGPROF;
+	sev.sigev_notify_thread_id = gettid();
+	if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &profile_timer) != 0)
+	{
+		sigaction(SIGPROF, &old_action, NULL);
+		return -1;
+	}
+
+	profile_worker = 1;
+	timer.it_value.tv_sec = hz == 1 ? 1 : 0;
+	timer.it_value.tv_nsec = hz == 1 ? 0 : 1000000000 / hz;
+	timer.it_interval = timer.it_value;
+	if (timer_settime(profile_timer, 0, &timer, NULL) != 0)
+	{
+		profile_worker = 0;
+		timer_delete(profile_timer);
+		sigaction(SIGPROF, &old_action, NULL);
+		return -1;
+	}
+
+	profiling = true;
+	return 0;
+}
+
+int uthread_profile_stop(void)
+{
+	size_t count;
+
+	if (!profiling)
+	{
+		return -1;
+	}
+
+	/* Deleting the timer stops it, no signal is sent after that */
+	timer_delete(profile_timer);
+	profile_worker = 0;
+	sigaction(SIGPROF, &old_action, NULL);
+	profiling = false;
+
+	count = __atomic_load_n(&sample_count, __ATOMIC_RELAXED);
+	if (count > PROFILE_SAMPLES)
+	{
+		fprintf(stderr, "profile: buffer full, %zu samples dropped\n",
+			count - PROFILE_SAMPLES);
+	}
+	return 0;
+}
+
+/*
+ * Append the name of a frame to @line, from its backtrace_symbols() string:
+ * `module(function+offset) [address]`, `module(+offset) [address]` or
+ * `[address]`
+ */
+static void profile_append_frame(char *line, const char *symbol)
+{
+	size_t len = strlen(line);
+	const char *open = strchr(symbol, '(');
+	const char *plus = open ? strchr(open, '+') : NULL;
+	const char *module = symbol;
+	const char *slash;
+	int n;
+
+	if (open && plus && plus > open + 1)
+	{
+		/* Function name */
+		n = snprintf(line + len, PROFILE_LINE_LEN - len, ";%.*s",
+			     (int)(plus - open - 1), open + 1);
+	}
+	else if (open && plus)
+	{
+		/* Module and offset, without the directory of the module */
+		for (slash = symbol; slash < open; slash++)
+		{
+			if (*slash == '/')
+			{
+				module = slash + 1;
+			}
+		}
+		n = snprintf(line + len, PROFILE_LINE_LEN - len, ";%.*s%.*s",
+			     (int)(open - module), module,
+			     (int)strcspn(plus, ")"), plus);
+	}
+	else
+	{
+		n = snprintf(line + len, PROFILE_LINE_LEN - len, ";%.*s",
+			     (int)strcspn(symbol, " "), symbol);
+	}
+
+	/* Leave the line truncated rather than partial */
+	if (n < 0 || (size_t)n >= PROFILE_LINE_LEN - len)
+	{
+		line[len] = '\0';
+	}
+}
+
+static void profile_free_lines(char **lines, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		free(lines[i]);
+	}
+	free(lines);
+}
+
+static int profile_compare(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+int uthread_profile_dump(const char *path)
+{
+	size_t count = profile_samples();
+	char **lines;
+	char **symbols;
+	size_t i, j;
+	int frame;
+	FILE *f;
+
+	if (profiling || !samples)
+	{
+		return -1;
+	}
+
+	lines = calloc(count ? count : 1, sizeof(char *));
+	if (!lines)
+	{
+		return -1;
+	}
+
+	/* Fold every sample into one line, from the outermost frame */
+	for (i = 0; i < count; i++)
+	{
+		struct profile_sample *sample = &samples[i];
+
+		lines[i] = malloc(PROFILE_LINE_LEN);
+		symbols = backtrace_symbols(sample->pcs, sample->depth);
+		if (!lines[i] || !symbols)
+		{
+			free(symbols);
+			profile_free_lines(lines, count);
+			return -1;
+		}
+
+		if (sample->tid == UINT32_MAX)
+		{
+			snprintf(lines[i], PROFILE_LINE_LEN, "(no uthread)");
+		}
+		else
+		{
+			snprintf(lines[i], PROFILE_LINE_LEN, "%s#%u",
+				 sample->name[0] ? sample->name : "uthread",
+				 sample->tid);
+		}
+		for (frame = sample->depth - 1; frame >= PROFILE_SKIP; frame--)
+		{
+			profile_append_frame(lines[i], symbols[frame]);
+		}
+		free(symbols);
+	}
+
+	f = fopen(path, "w");
+	if (!f)
+	{
+		profile_free_lines(lines, count);
+		return -1;
+	}
+
+	/* Count identical stacks */
+	qsort(lines, count, sizeof(char *), profile_compare);
+	for (i = 0; i < count; i = j)
+	{
+		j = i + 1;
+		while (j < count && !strcmp(lines[i], lines[j]))
+		{
+			j++;
+		}
+		fprintf(f, "%s %zu\n", lines[i], j - i);
+	}
+
+	profile_free_lines(lines, count);
+	return fclose(f) == 0 ? (int)count : -1;
+}
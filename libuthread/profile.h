@@ -0,0 +1,65 @@
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+/*
+ * Sampling profiler
+ *
+ * While started, the profiler samples the running thread at a fixed rate of
+ * CPU time of the worker, using SIGPROF sent to the worker alone. The time
+ * spent by other kernel threads (e.g., calling uthread_submit()) is not
+ * sampled. Every sample records the thread and its
+ * backtrace, on whatever stack the thread runs. Samples are written as folded
+ * stacks, one line per distinct stack with its number of samples, whose first
+ * frame is the thread (e.g., `worker#3;main_loop;handle;sem_down 42`). This is
+ * the input format of flame graph tools (e.g., flamegraph.pl, speedscope).
+ *
+ * The profiler uses its own timer and signal, and runs along with preemption:
+ * the preemption signal is held while a sample is taken. A sample taken in the
+ * middle of a context switch may be attributed to the incoming thread.
+ *
+ * Frames are named from the dynamic symbol table, which only holds the
+ * functions of a program linked with `-rdynamic`. Without it, every frame of
+ * the program itself comes out raw, as `binary+offset` (e.g., `app.x+0x1a2b`),
+ * and only the frames of shared libraries are named.
+ */
+
+/* Default sampling frequency, chosen not to beat with the preemption timer */
+#define UTHREAD_PROFILE_HZ	997
+
+/*
+ * uthread_profile_start - Start sampling
+ * @hz: Number of samples per second of CPU time, or 0 for UTHREAD_PROFILE_HZ
+ *
+ * Must be called from the worker, i.e. the kernel thread calling uthread_run(),
+ * before or during the run.
+ *
+ * Rates over 1 MHz are clamped to one sample per microsecond of CPU time. The
+ * kernel may deliver fewer samples than asked, depending on its timer tick.
+ *
+ * Samples of a previous profile are discarded. Samples are kept in a buffer
+ * allocated here, and are dropped once it is full.
+ *
+ * Return: 0 in case of success, -1 if the profiler is already started or in
+ * case of failure (e.g., memory allocation)
+ */
+int uthread_profile_start(unsigned int hz);
+
+/*
+ * uthread_profile_stop - Stop sampling
+ *
+ * Return: 0 in case of success, -1 if the profiler was not started
+ */
+int uthread_profile_stop(void);
+
+/*
+ * uthread_profile_dump - Write the samples as folded stacks
+ * @path: Path of the file to write
+ *
+ * Must be called after uthread_profile_stop().
+ *
+ * Return: Number of samples written, or -1 in case of failure (e.g., profiler
+ * still running, memory allocation, file creation)
+ */
+int uthread_profile_dump(const char *path);
+
+#endif /* _PROFILE_H */
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "pool.h"
 #include "queue.h"
 
 struct queue
@@ -21,9 +22,9 @@ struct node
 
 queue_t queue_create(void)
 {
-	// malloc queue
+	// allocate queue
 	queue_t queue;
-	queue = malloc(sizeof(queue_t));
+	queue = pool_alloc(sizeof(struct queue));
 
 	if (!queue)
 	{
@@ -46,21 +47,25 @@ int queue_destroy(queue_t queue)
 	}
 
 	/* Free from memory */
-	free(queue);
+	pool_free(queue);
 	return 0;
 }
 
-int queue_enqueue(queue_t queue, void *data)
+queue_handle_t queue_enqueue_handle(queue_t queue, void *data)
 {
 	/* Allocate memory for a new node */
 	/* The newest node will always be the rear */
 	struct node *info_node;
 
-	info_node = malloc(sizeof(struct node));
+	if (!queue || !data)
+	{
+		return NULL;
+	}
 
-	if (!queue || !data || !info_node)
+	info_node = pool_alloc(sizeof(struct node));
+	if (!info_node)
 	{
-		return -1;
+		return NULL;
 	}
 
 	info_node->prev = NULL;
@@ -83,7 +88,12 @@ int queue_enqueue(queue_t queue, void *data)
 		queue->rear = info_node;
 	}
 	queue->len++;
-	return 0;
+	return info_node;
+}
+
+int queue_enqueue(queue_t queue, void *data)
+{
+	return queue_enqueue_handle(queue, data) ? 0 : -1;
 }
 
 int queue_dequeue(queue_t queue, void **data)
@@ -94,7 +104,8 @@ int queue_dequeue(queue_t queue, void **data)
 	}
 
 	/* Point to the data in the queue head */
-	*data = queue->front->data;
+	struct node *oldFront = queue->front;
+	*data = oldFront->data;
 
 	/* 2 cases:
 	1. There is only one item left
@@ -109,12 +120,39 @@ int queue_dequeue(queue_t queue, void **data)
 	else
 	{
 		queue->front = queue->front->next;
+		queue->front->prev = NULL;
 	}
 	queue->len--;
+	pool_free(oldFront);
 
 	return 0;
 }
 
+/* Unlink @node from @queue and free it, updating the queue's front and rear when it is at either end */
+static void queue_unlink(queue_t queue, struct node *node)
+{
+	if (node == queue->front)
+	{
+		queue->front = node->next;
+	}
+	else
+	{
+		node->prev->next = node->next;
+	}
+	if (node == queue->rear)
+	{
+		queue->rear = node->prev;
+	}
+	else
+	{
+		node->next->prev = node->prev;
+	}
+
+	/* Decrement Queue Length */
+	queue->len--;
+	pool_free(node);
+}
+
 int queue_delete(queue_t queue, void *data)
 {
 	if (!queue || !data)
@@ -123,70 +161,91 @@ int queue_delete(queue_t queue, void *data)
 	}
 
 	/* We will look for the data, pointing to next, until we can find the data */
-	struct node *currentNode;
-	int retval = 0; // Default value of retval set to 0, will only need to change if we reach the end with nothing
-	currentNode = malloc(sizeof(struct node));
-	currentNode = queue->front;
+	struct node *currentNode = queue->front;
 
-	/* Iterate through queue to find data */
-	while (currentNode->data != data)
+	/* Iterate through queue to find data, fail if we reach the end with nothing */
+	while (currentNode != NULL && currentNode->data != data)
 	{
 		currentNode = currentNode->next;
-		if (currentNode == queue->rear)
-		{
-			retval = -1;
-			break;
-		}
-	}
-
-	/* Set data to null */
-	currentNode->data = NULL;
-
-	/* If element is at the front with no previous, then set the queue's front to the node's next node */
-	if (currentNode->prev == NULL)
-	{
-		queue->front = currentNode->next;
-		currentNode->next->prev = NULL;
 	}
-	else if (currentNode->next == NULL)
+	if (currentNode == NULL)
 	{
-		queue->rear = currentNode->prev;
-		currentNode->prev->next = NULL;
+		return -1;
 	}
-	else
+
+	queue_unlink(queue, currentNode);
+	return 0;
+}
+
+int queue_remove_handle(queue_t queue, queue_handle_t handle)
+{
+	if (!queue || !handle)
 	{
-		/* Reset pointers for the rest of the nodes */
-		currentNode->next->prev = currentNode->prev;
-		currentNode->prev->next = currentNode->next;
+		return -1;
 	}
 
-	/* Decrement Queue Length */
-	queue->len--;
-
-	return retval;
+	queue_unlink(queue, handle);
+	return 0;
 }
 
 int queue_iterate(queue_t queue, queue_func_t func)
 {
 	struct node *currentNode;
-	currentNode = malloc(sizeof(struct node));
+	struct node *nextNode;
 
 	if (!queue || !func)
 	{
 		return -1;
 	}
 
-	/* Iterate beginning from head */
+	/* Iterate beginning from head, the current node may be deleted by @func */
 	currentNode = queue->front;
 	while (currentNode != NULL)
 	{
+		nextNode = currentNode->next;
 		func(queue, currentNode->data);
-		currentNode = currentNode->next;
+		currentNode = nextNode;
 	}
 
 	return 0;
 }
 
+int queue_concat(queue_t dst, queue_t src)
+{
+	if (!dst || !src)
+	{
+		return -1;
+	}
+
+	/* Nothing to move */
+	if (src->len == 0)
+	{
+		return 0;
+	}
+
+	/* 2 cases:
+	1. If the destination is empty, it simply takes over the source's list
+	2. Otherwise, the source's front is linked after the destination's rear */
+	if (dst->len == 0)
+	{
+		dst->front = src->front;
+	}
+	else
+	{
+		src->front->prev = dst->rear;
+		dst->rear->next = src->front;
+	}
+	dst->rear = src->rear;
+	dst->len += src->len;
+
+	/* Source is left empty */
+	src->front = NULL;
+	src->rear = NULL;
+	src->len = 0;
+
+	return 0;
+}
+
 int queue_length(queue_t queue)
 {
 	if (!queue)
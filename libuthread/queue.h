@@ -12,6 +12,15 @@
  */
 typedef struct queue* queue_t;
 
+/*
+ * queue_handle_t - Handle of a queued item
+ *
+ * Returned by queue_enqueue_handle(), to remove the item in O(1) with
+ * queue_remove_handle(). A handle is only valid while its item is in the
+ * queue: it must not be used once the item was dequeued or deleted.
+ */
+typedef struct node* queue_handle_t;
+
 /*
  * queue_create - Allocate an empty queue
  *
@@ -45,6 +54,31 @@ int queue_destroy(queue_t queue);
  */
 int queue_enqueue(queue_t queue, void *data);
 
+/*
+ * queue_enqueue_handle - Enqueue data item and get its handle
+ * @queue: Queue in which to enqueue item
+ * @data: Address of data item to enqueue
+ *
+ * Same as queue_enqueue(), but return a handle to the item, to remove it from
+ * the queue later without searching for it.
+ *
+ * Return: NULL if @queue or @data are NULL, or in case of memory allocation
+ * error when enqueing. Handle of the item otherwise.
+ */
+queue_handle_t queue_enqueue_handle(queue_t queue, void *data);
+
+/*
+ * queue_remove_handle - Remove item by handle
+ * @queue: Queue holding the item
+ * @handle: Handle of the item, as returned by queue_enqueue_handle()
+ *
+ * Remove the item of @handle from queue @queue in O(1), wherever it is in the
+ * queue. @handle is invalid afterwards.
+ *
+ * Return: -1 if @queue or @handle are NULL. 0 if the item was removed.
+ */
+int queue_remove_handle(queue_t queue, queue_handle_t handle);
+
 /*
  * queue_dequeue - Dequeue data item
  * @queue: Queue in which to dequeue item
@@ -97,6 +131,19 @@ typedef void (*queue_func_t)(queue_t queue, void *data);
  */
 int queue_iterate(queue_t queue, queue_func_t func);
 
+/*
+ * queue_concat - Move all items of a queue to the end of another queue
+ * @dst: Queue receiving the items
+ * @src: Queue whose items are moved
+ *
+ * Append all the items of queue @src, from the oldest to the newest, after the
+ * newest item of queue @dst. Queue @src is left empty. This is done in O(1) by
+ * relinking both lists, no matter how many items are moved.
+ *
+ * Return: -1 if @dst or @src are NULL. 0 otherwise.
+ */
+int queue_concat(queue_t dst, queue_t src);
+
 /*
  * queue_length - Queue length
  * @queue: Queue to get the length of
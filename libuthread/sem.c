@@ -1,20 +1,97 @@
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 
+#include "pool.h"
 #include "queue.h"
 #include "sem.h"
 #include "private.h"
 #include "uthread.h"
 
+#ifdef UTHREAD_SEM_PROFILE
+/* sem_create() is the function itself here, not the labeling macro */
+#undef sem_create
+
+/* Buckets of the wait histograms, bucket i counts waits of [2^i, 2^(i+1)) ns */
+#define SEM_HIST_BUCKETS 40
+
+/* Profile of a semaphore, kept after the semaphore is destroyed */
+struct sem_profile
+{
+	const char *site;
+	uint64_t acquisitions;
+	uint64_t contended;
+	size_t max_waiters;
+	uint64_t wait_ns;
+	uint64_t hist[SEM_HIST_BUCKETS];
+	bool destroyed;
+	struct sem_profile *next;
+};
+
+/* Profiles of all the semaphores ever created, newest first */
+static struct sem_profile *profiles;
+static size_t profile_count;
+#endif /* UTHREAD_SEM_PROFILE */
+
 struct semaphore
 {
 	queue_t waiting_threads;
 	size_t sem_count;
+#ifdef UTHREAD_SEM_PROFILE
+	struct sem_profile *profile;
+#endif
 };
 
+#ifdef UTHREAD_SEM_PROFILE
+/* Record an acquisition of @sem, after blocking for @wait_ns if contended */
+static void sem_profile_acquired(sem_t sem, bool contended, uint64_t wait_ns)
+{
+	struct sem_profile *profile = sem->profile;
+	int bucket = 0;
+
+	profile->acquisitions++;
+	if (!contended)
+	{
+		return;
+	}
+
+	profile->contended++;
+	profile->wait_ns += wait_ns;
+	if (wait_ns > 0)
+	{
+		bucket = 63 - __builtin_clzll(wait_ns);
+	}
+	if (bucket >= SEM_HIST_BUCKETS)
+	{
+		bucket = SEM_HIST_BUCKETS - 1;
+	}
+	profile->hist[bucket]++;
+}
+
+/* Record the number of threads waiting on @sem */
+static void sem_profile_waiters(sem_t sem)
+{
+	size_t waiters = queue_length(sem->waiting_threads);
+
+	if (waiters > sem->profile->max_waiters)
+	{
+		sem->profile->max_waiters = waiters;
+	}
+}
+
+#define SEM_PROFILE_ACQUIRED(sem, contended, wait_ns) \
+	sem_profile_acquired(sem, contended, wait_ns)
+#define SEM_PROFILE_WAITERS(sem) sem_profile_waiters(sem)
+#else
+#define SEM_PROFILE_ACQUIRED(sem, contended, wait_ns) do { } while (0)
+#define SEM_PROFILE_WAITERS(sem) do { } while (0)
+#endif /* UTHREAD_SEM_PROFILE */
+
 sem_t sem_create(size_t count)
 {
-	sem_t semaphore = malloc(sizeof(struct semaphore));
+	sem_t semaphore = pool_alloc(sizeof(struct semaphore));
 
 	if (!semaphore)
 	{
@@ -23,8 +100,35 @@ sem_t sem_create(size_t count)
 
 	semaphore->waiting_threads = queue_create();
 	semaphore->sem_count = count;
+
+#ifdef UTHREAD_SEM_PROFILE
+	semaphore->profile = calloc(1, sizeof(struct sem_profile));
+	if (!semaphore->profile)
+	{
+		pool_free(semaphore);
+		return NULL;
+	}
+	semaphore->profile->site = "(unlabeled)";
+	semaphore->profile->next = profiles;
+	profiles = semaphore->profile;
+	profile_count++;
+#endif
+
+	return semaphore;
+}
+
+#ifdef UTHREAD_SEM_PROFILE
+sem_t sem_create_at(size_t count, const char *site)
+{
+	sem_t semaphore = sem_create(count);
+
+	if (semaphore && site)
+	{
+		semaphore->profile->site = site;
+	}
 	return semaphore;
 }
+#endif
 
 int sem_destroy(sem_t sem)
 {
@@ -33,7 +137,11 @@ int sem_destroy(sem_t sem)
 		return -1;
 	}
 
-	free(sem);
+#ifdef UTHREAD_SEM_PROFILE
+	sem->profile->destroyed = true;
+#endif
+
+	pool_free(sem);
 	return 0;
 }
 
@@ -47,20 +155,106 @@ int sem_down(sem_t sem)
 
 	struct uthread_tcb *current_thread = uthread_current();
 
+	/*
+	 * Timed out waiters leave the queue from the scheduler, which a tick
+	 * can enter at any time
+	 */
+	preempt_disable();
+
 	/* Check if there are still resources available */
 	if (sem->sem_count != 0)
 	{
 		sem->sem_count--;
+		SEM_PROFILE_ACQUIRED(sem, false, 0);
+		preempt_enable();
 	}
 	else if (sem->sem_count == 0)
 	{
 		/* No more resource left, add to waiting queue for resource */
+		uint64_t wait_start = uthread_clock_ns();
+
 		queue_enqueue(sem->waiting_threads, current_thread);
+		SEM_PROFILE_WAITERS(sem);
+
+		/* Re-enables preemption once woken up */
 		uthread_block();
+
+		wait_start = uthread_clock_ns() - wait_start;
+		uthread_account_sem_wait(wait_start);
+		SEM_PROFILE_ACQUIRED(sem, true, wait_start);
 	}
 	return 0;
 }
 
+/* Waiter of sem_down_timeout(), removed from the waiting list on timeout */
+struct sem_waiter
+{
+	sem_t sem;
+	queue_handle_t handle;
+};
+
+static void sem_waiter_expire(void *arg)
+{
+	struct sem_waiter *waiter = (struct sem_waiter *)arg;
+
+	queue_remove_handle(waiter->sem->waiting_threads, waiter->handle);
+}
+
+int sem_down_timeout(sem_t sem, uint64_t ns)
+{
+	struct sem_waiter waiter;
+	uint64_t wait_start;
+	int retval;
+
+	if (!sem)
+	{
+		return -1;
+	}
+
+	preempt_disable();
+
+	/* Check if there are still resources available */
+	if (sem->sem_count != 0)
+	{
+		sem->sem_count--;
+		SEM_PROFILE_ACQUIRED(sem, false, 0);
+		preempt_enable();
+		return 0;
+	}
+	if (ns == 0)
+	{
+		preempt_enable();
+		return -1;
+	}
+
+	/* Wait in the queue, from which the timer takes us out on expiry */
+	wait_start = uthread_clock_ns();
+	waiter.sem = sem;
+	waiter.handle = queue_enqueue_handle(sem->waiting_threads, uthread_current());
+	if (!waiter.handle)
+	{
+		preempt_enable();
+		return -1;
+	}
+	SEM_PROFILE_WAITERS(sem);
+
+	retval = event_block_timeout(ns, sem_waiter_expire, &waiter);
+	if (retval < 0)
+	{
+		queue_remove_handle(sem->waiting_threads, waiter.handle);
+	}
+	preempt_enable();
+
+	wait_start = uthread_clock_ns() - wait_start;
+	uthread_account_sem_wait(wait_start);
+	if (retval != 0)
+	{
+		return -1;
+	}
+	SEM_PROFILE_ACQUIRED(sem, true, wait_start);
+	return 0;
+}
+
 /* Release waiting threads if any or release resource */
 int sem_up(sem_t sem)
 {
@@ -71,6 +265,8 @@ int sem_up(sem_t sem)
 		return -1;
 	}
 
+	preempt_disable();
+
 	/* Check if sem count was at 0 */
 	if (sem->sem_count == 0)
 	{
@@ -91,6 +287,111 @@ int sem_up(sem_t sem)
 	{
 		sem->sem_count++;
 	}
+	preempt_enable();
 
 	return 0;
 }
+
+#ifdef UTHREAD_SEM_PROFILE
+/* Order profiles by contended acquisitions, then by total wait time */
+static int sem_profile_compare(const void *a, const void *b)
+{
+	const struct sem_profile *x = *(struct sem_profile * const *)a;
+	const struct sem_profile *y = *(struct sem_profile * const *)b;
+
+	if (x->contended != y->contended)
+	{
+		return x->contended < y->contended ? 1 : -1;
+	}
+	return (x->wait_ns < y->wait_ns) - (x->wait_ns > y->wait_ns);
+}
+
+/* Format @ns in @buf, with the largest unit that keeps it at least 1 */
+static void sem_profile_format_time(char *buf, size_t len, uint64_t ns)
+{
+	if (ns >= 1000000000)
+	{
+		snprintf(buf, len, "%llus", (unsigned long long)(ns / 1000000000));
+	}
+	else if (ns >= 1000000)
+	{
+		snprintf(buf, len, "%llums", (unsigned long long)(ns / 1000000));
+	}
+	else if (ns >= 1000)
+	{
+		snprintf(buf, len, "%lluus", (unsigned long long)(ns / 1000));
+	}
+	else
+	{
+		snprintf(buf, len, "%lluns", (unsigned long long)ns);
+	}
+}
+
+int sem_profile_report(size_t top)
+{
+	struct sem_profile **sorted = NULL;
+	struct sem_profile *profile;
+	char time[32];
+	size_t i = 0;
+	int b;
+
+	if (profile_count > 0)
+	{
+		sorted = malloc(profile_count * sizeof(struct sem_profile *));
+		if (!sorted)
+		{
+			return -1;
+		}
+	}
+	for (profile = profiles; profile; profile = profile->next)
+	{
+		sorted[i++] = profile;
+	}
+	if (profile_count > 1)
+	{
+		qsort(sorted, profile_count, sizeof(struct sem_profile *), sem_profile_compare);
+	}
+
+	if (top == 0 || top > profile_count)
+	{
+		top = profile_count;
+	}
+
+	fprintf(stderr, "semaphore profile: top %zu of %zu semaphores, by contended acquisitions\n",
+		top, profile_count);
+	fprintf(stderr, "%-32s %12s %12s %8s %10s\n", "site", "acquired",
+		"contended", "waiters", "avg wait");
+	for (i = 0; i < top; i++)
+	{
+		profile = sorted[i];
+		sem_profile_format_time(time, sizeof(time), profile->contended ?
+					profile->wait_ns / profile->contended : 0);
+		fprintf(stderr, "%-32s %12llu %12llu %8zu %10s%s\n",
+			profile->site, (unsigned long long)profile->acquisitions,
+			(unsigned long long)profile->contended, profile->max_waiters,
+			time, profile->destroyed ? " (destroyed)" : "");
+
+		/* Wait histogram, only the buckets that were hit */
+		for (b = 0; b < SEM_HIST_BUCKETS; b++)
+		{
+			if (profile->hist[b] > 0)
+			{
+				sem_profile_format_time(time, sizeof(time), 1ULL << b);
+				fprintf(stderr, "    >= %-8s %llu\n", time,
+					(unsigned long long)profile->hist[b]);
+			}
+		}
+	}
+
+	free(sorted);
+	return 0;
+}
+#else
+int sem_profile_report(size_t top)
+{
+	(void)top;
+
+	/* Semaphore profiling was not compiled in */
+	return -1;
+}
+#endif /* UTHREAD_SEM_PROFILE */
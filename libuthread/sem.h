@@ -50,6 +50,21 @@ int sem_destroy(sem_t sem);
  */
 int sem_down(sem_t sem);
 
+/*
+ * sem_down_timeout - Take a semaphore, or give up after some time
+ * @sem: Semaphore to take
+ * @ns: Maximum time to wait (in nanoseconds), 0 to not wait at all
+ *
+ * Same as sem_down(), but the caller stops waiting once @ns nanoseconds have
+ * passed. It is then taken out of the waiting list of @sem in O(1), without
+ * consuming a resource.
+ *
+ * Return: -1 if @sem is NULL, if the semaphore could not be taken in time, or
+ * in case of failure (e.g., memory allocation). 0 if semaphore was
+ * successfully taken.
+ */
+int sem_down_timeout(sem_t sem, uint64_t ns);
+
 /*
  * sem_up - Release a semaphore
  * @sem: Semaphore to release
@@ -64,4 +79,36 @@ int sem_down(sem_t sem);
  */
 int sem_up(sem_t sem);
 
+/*
+ * sem_profile_report - Report the most contended semaphores
+ * @top: Maximum number of semaphores to report, 0 for all of them
+ *
+ * When the library is built with `make SEM_PROFILE=1`, every semaphore counts
+ * its acquisitions, the acquisitions that had to block, its largest number of
+ * waiters, and keeps a histogram of the blocked times with power-of-two
+ * buckets. Semaphores are labeled with the place where they were created,
+ * provided the calling file is also built with UTHREAD_SEM_PROFILE defined.
+ *
+ * This function prints the @top semaphores with the most contended
+ * acquisitions on the standard error, including destroyed ones.
+ *
+ * Return: 0 in case of success, -1 if semaphore profiling was not built in
+ */
+int sem_profile_report(size_t top);
+
+#ifdef UTHREAD_SEM_PROFILE
+/*
+ * sem_create_at - Create semaphore, labeled with its creation site
+ * @count: Semaphore count
+ * @site: Label of the semaphore in the profile report
+ *
+ * Only used through the sem_create() macro below, in profiled builds.
+ */
+sem_t sem_create_at(size_t count, const char *site);
+
+#define SEM_STR(x) #x
+#define SEM_SITE(file, line) file ":" SEM_STR(line)
+#define sem_create(count) sem_create_at(count, SEM_SITE(__FILE__, __LINE__))
+#endif /* UTHREAD_SEM_PROFILE */
+
 #endif /* _SEMAPHORE_H */
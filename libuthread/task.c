@@ -0,0 +1,176 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "private.h"
+#include "task.h"
+#include "uthread.h"
+
+/* Initial capacity of the pending task ring */
+#define TASK_RING_SIZE 64
+
+/* Number of tasks a carrier runs before yielding to other threads */
+#define TASK_BATCH 64
+
+struct task
+{
+	uthread_func_t func;
+	void *arg;
+};
+
+/* Pending tasks, in a ring that grows when full */
+static struct task *ring;
+static size_t ring_head;
+static size_t ring_count;
+static size_t ring_size;
+
+/* Thread currently carrying tasks, and whether a new one is being started */
+static struct uthread_tcb *carrier;
+static bool carrier_starting;
+
+/* Grow the ring to twice its size, keeping the pending tasks in order */
+static int task_ring_grow(void)
+{
+	size_t size = ring_size ? ring_size * 2 : TASK_RING_SIZE;
+	struct task *new_ring = malloc(size * sizeof(struct task));
+	size_t i;
+
+	if (!new_ring)
+	{
+		return -1;
+	}
+
+	for (i = 0; i < ring_count; i++)
+	{
+		new_ring[i] = ring[(ring_head + i) % ring_size];
+	}
+
+	free(ring);
+	ring = new_ring;
+	ring_head = 0;
+	ring_size = size;
+	return 0;
+}
+
+/* Pop the oldest pending task, must be called with preemption disabled */
+static int task_pop(struct task *task)
+{
+	if (ring_count == 0)
+	{
+		return -1;
+	}
+
+	*task = ring[ring_head];
+	ring_head = (ring_head + 1) % ring_size;
+	ring_count--;
+	return 0;
+}
+
+/* Carrier thread: run pending tasks until there are none left */
+static void task_carrier(void *arg)
+{
+	struct uthread_tcb *self = uthread_current();
+	struct task task;
+	size_t batch = 0;
+	(void)arg;
+
+	preempt_disable();
+	carrier_starting = false;
+	carrier = self;
+
+	while (carrier == self && task_pop(&task) == 0)
+	{
+		preempt_enable();
+		task.func(task.arg);
+
+		/* Don't starve regular threads when many tasks are pending */
+		if (++batch == TASK_BATCH)
+		{
+			batch = 0;
+			uthread_yield();
+		}
+		preempt_disable();
+
+		/*
+		 * If the task blocked, we lost the carrier role. Take it back,
+		 * unless another carrier was started in the meantime.
+		 */
+		if (!carrier && !carrier_starting)
+		{
+			carrier = self;
+		}
+	}
+
+	if (carrier == self)
+	{
+		carrier = NULL;
+	}
+	preempt_enable();
+}
+
+/*
+ * Start a new carrier, must be called with preemption disabled. The carrier
+ * cannot run before it is marked as starting, since preemption stays disabled.
+ */
+static int task_carrier_start(void)
+{
+	carrier_starting = true;
+	if (uthread_create_locked(NULL, NULL, task_carrier, NULL) != 0)
+	{
+		carrier_starting = false;
+		return -1;
+	}
+
+	return 0;
+}
+
+int uthread_task_spawn(uthread_func_t func, void *arg)
+{
+	int retval = 0;
+
+	if (!func)
+	{
+		return -1;
+	}
+
+	preempt_disable();
+	if (ring_count == ring_size && task_ring_grow() != 0)
+	{
+		preempt_enable();
+		return -1;
+	}
+
+	ring[(ring_head + ring_count) % ring_size].func = func;
+	ring[(ring_head + ring_count) % ring_size].arg = arg;
+	ring_count++;
+
+	if (!carrier && !carrier_starting)
+	{
+		retval = task_carrier_start();
+		if (retval != 0)
+		{
+			ring_count--;
+		}
+	}
+	preempt_enable();
+
+	return retval;
+}
+
+void uthread_task_blocked(struct uthread_tcb *uthread)
+{
+	if (uthread != carrier)
+	{
+		return;
+	}
+
+	/*
+	 * The task keeps the stack of the carrier, which becomes a regular
+	 * thread. Another carrier takes over the pending tasks.
+	 */
+	carrier = NULL;
+	if (ring_count > 0 && !carrier_starting)
+	{
+		task_carrier_start();
+	}
+}
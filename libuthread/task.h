@@ -0,0 +1,29 @@
+#ifndef _TASK_H
+#define _TASK_H
+
+#include "uthread.h"
+
+/*
+ * uthread_task_spawn - Spawn a lightweight task
+ * @func: Function to be executed by the task
+ * @arg: Argument to be passed to the task
+ *
+ * A task is a function that is expected to run to completion without
+ * blocking. Spawning one only records @func and @arg in a queue: no stack nor
+ * TCB is allocated for it.
+ *
+ * Pending tasks are run one after the other by a carrier thread, on the
+ * carrier's stack. If a task blocks (e.g., on a semaphore), it keeps the
+ * carrier's stack and becomes a regular thread until it returns, while a new
+ * carrier is started for the remaining tasks. A stack is therefore only
+ * allocated for tasks that actually block. Likewise, a task calling
+ * uthread_exit() ends its carrier, and a new one takes over.
+ *
+ * This function must be called from a thread.
+ *
+ * Return: 0 in case of success, -1 if @func is NULL or in case of failure
+ * (e.g., memory allocation, carrier creation).
+ */
+int uthread_task_spawn(uthread_func_t func, void *arg);
+
+#endif /* _TASK_H */
@@ -0,0 +1,225 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+#include "uthread.h"
+
+#ifdef UTHREAD_TRACE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Number of events kept in the ring buffer, must be a power of two */
+#define TRACE_RING_SIZE (1 << 16)
+
+/* Characters of the thread names kept in TRACE_CREATE events */
+#define TRACE_NAME_LEN 12
+
+/* One event, 32 bytes so that two of them fit in a cache line */
+struct trace_record
+{
+	uint64_t tsc;
+	uint32_t type;
+	uint32_t tid;
+	uint32_t arg;
+	char name[TRACE_NAME_LEN];
+};
+
+/*
+ * Ring buffer of the worker. The library has a single worker, and events are
+ * only recorded with preemption disabled, so the ring needs no locking.
+ */
+static struct trace_record ring[TRACE_RING_SIZE];
+static uint64_t ring_next;
+
+/* Reference points to convert timestamps to microseconds */
+static uint64_t start_tsc;
+static double start_ns;
+
+static const char *trace_names[] =
+{
+	[TRACE_CREATE] = "create",
+	[TRACE_SWITCH] = "switch",
+	[TRACE_BLOCK] = "block",
+	[TRACE_UNBLOCK] = "unblock",
+	[TRACE_PREEMPT] = "preempt",
+	[TRACE_EXIT] = "exit",
+};
+
+static double trace_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Timestamp counter, or nanoseconds where there is no such counter */
+static inline uint64_t trace_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return (uint64_t)trace_now_ns();
+#endif
+}
+
+void trace_event(enum trace_type type, uint32_t tid, uint32_t arg,
+		 const char *name)
+{
+	struct trace_record *rec = &ring[ring_next & (TRACE_RING_SIZE - 1)];
+
+	if (ring_next == 0)
+	{
+		start_ns = trace_now_ns();
+		start_tsc = trace_clock();
+	}
+
+	rec->tsc = trace_clock();
+	rec->type = type;
+	rec->tid = tid;
+	rec->arg = arg;
+	rec->name[0] = '\0';
+	if (name)
+	{
+		size_t len;
+
+		strncpy(rec->name, name, TRACE_NAME_LEN - 1);
+		rec->name[TRACE_NAME_LEN - 1] = '\0';
+
+		/* Keep the name safe to print as a JSON string */
+		for (len = 0; rec->name[len]; len++)
+		{
+			if (rec->name[len] == '"' || rec->name[len] == '\\' ||
+			    (unsigned char)rec->name[len] < ' ')
+			{
+				rec->name[len] = '_';
+			}
+		}
+	}
+	ring_next++;
+}
+
+/* Number of timestamp ticks per microsecond, measured since the first event */
+static double trace_ticks_per_us(void)
+{
+	struct timespec pause = { 0, 10000000 };
+	double elapsed_ns = trace_now_ns() - start_ns;
+
+	/* Measure over at least 10ms to get a meaningful ratio */
+	if (elapsed_ns < 1e7)
+	{
+		nanosleep(&pause, NULL);
+		elapsed_ns = trace_now_ns() - start_ns;
+	}
+
+	return (trace_clock() - start_tsc) / (elapsed_ns / 1e3);
+}
+
+int uthread_trace_dump(const char *path)
+{
+	uint64_t first = ring_next > TRACE_RING_SIZE ? ring_next - TRACE_RING_SIZE : 0;
+	double ticks_per_us = trace_ticks_per_us();
+	double *running_since;
+	uint32_t max_tid = 0;
+	double ts = 0;
+	uint64_t i;
+	FILE *f;
+
+	/* Running slices are built from the switch events, for every thread */
+	for (i = first; i < ring_next; i++)
+	{
+		struct trace_record *rec = &ring[i & (TRACE_RING_SIZE - 1)];
+
+		max_tid = rec->tid > max_tid ? rec->tid : max_tid;
+		max_tid = rec->arg > max_tid ? rec->arg : max_tid;
+	}
+	running_since = malloc((max_tid + 1) * sizeof(double));
+	if (!running_since)
+	{
+		return -1;
+	}
+	for (i = 0; i <= max_tid; i++)
+	{
+		running_since[i] = -1;
+	}
+
+	f = fopen(path, "w");
+	if (!f)
+	{
+		free(running_since);
+		return -1;
+	}
+
+	fprintf(f, "{\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+		"\"args\":{\"name\":\"uthread worker 0\"}},\n");
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+		"\"args\":{\"name\":\"idle\"}}");
+
+	for (i = first; i < ring_next; i++)
+	{
+		struct trace_record *rec = &ring[i & (TRACE_RING_SIZE - 1)];
+
+		ts = (rec->tsc - start_tsc) / ticks_per_us;
+
+		if (rec->type == TRACE_CREATE)
+		{
+			fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\","
+				"\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s#%u\"}}",
+				rec->tid, rec->name[0] ? rec->name : "uthread",
+				rec->tid);
+		}
+
+		if (rec->type == TRACE_SWITCH)
+		{
+			if (running_since[rec->tid] >= 0)
+			{
+				fprintf(f, ",\n{\"name\":\"running\",\"ph\":\"X\","
+					"\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+					rec->tid, running_since[rec->tid],
+					ts - running_since[rec->tid]);
+			}
+			running_since[rec->tid] = -1;
+			running_since[rec->arg] = ts;
+			continue;
+		}
+
+		fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\","
+			"\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"other\":%u}}",
+			trace_names[rec->type], rec->tid, ts, rec->arg);
+	}
+
+	/* Close the slices of threads still running at the last event */
+	for (i = 0; i <= max_tid; i++)
+	{
+		if (running_since[i] >= 0)
+		{
+			fprintf(f, ",\n{\"name\":\"running\",\"ph\":\"X\","
+				"\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				(uint32_t)i, running_since[i], ts - running_since[i]);
+		}
+	}
+
+	fprintf(f, "\n]}\n");
+	free(running_since);
+	return fclose(f) == 0 ? 0 : -1;
+}
+
+#else
+
+int uthread_trace_dump(const char *path)
+{
+	(void)path;
+
+	/* Tracing was not compiled in */
+	return -1;
+}
+
+#endif /* UTHREAD_TRACE */
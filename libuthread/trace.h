@@ -0,0 +1,56 @@
+#ifndef _UTHREAD_TRACE_H
+#define _UTHREAD_TRACE_H
+
+/*
+ * This header is only meant to be included by files from the libuthread. It
+ * defines the scheduler tracing hooks, which are only compiled in when
+ * building the library with `make TRACE=1` (i.e., with UTHREAD_TRACE defined).
+ * Otherwise, TRACE() expands to nothing and tracing has no cost at all.
+ */
+
+#include <stdint.h>
+
+/*
+ * Scheduler events
+ *
+ * TRACE_CREATE: thread @tid was created by thread @arg
+ * TRACE_SWITCH: thread @tid was switched out for thread @arg
+ * TRACE_BLOCK: thread @tid blocked
+ * TRACE_UNBLOCK: thread @tid was unblocked by thread @arg
+ * TRACE_PREEMPT: thread @tid was preempted by the timer
+ * TRACE_EXIT: thread @tid exited
+ */
+enum trace_type
+{
+	TRACE_CREATE = 0,
+	TRACE_SWITCH = 1,
+	TRACE_BLOCK = 2,
+	TRACE_UNBLOCK = 3,
+	TRACE_PREEMPT = 4,
+	TRACE_EXIT = 5,
+};
+
+#ifdef UTHREAD_TRACE
+
+/*
+ * trace_event - Record a scheduler event
+ * @type: Type of the event
+ * @tid: Thread the event is about
+ * @arg: Other thread involved in the event, if any
+ * @name: Name of the thread for TRACE_CREATE events, NULL otherwise
+ *
+ * Events are timestamped with the CPU timestamp counter and stored in a ring
+ * buffer, where the newest events overwrite the oldest ones.
+ */
+void trace_event(enum trace_type type, uint32_t tid, uint32_t arg,
+		 const char *name);
+
+#define TRACE(type, tid, arg, name) trace_event(type, tid, arg, name)
+
+#else
+
+#define TRACE(type, tid, arg, name) do { } while (0)
+
+#endif /* UTHREAD_TRACE */
+
+#endif /* _UTHREAD_TRACE_H */
@@ -4,9 +4,14 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "pool.h"
 #include "private.h"
+#include "trace.h"
 #include "uthread.h"
 #include "queue.h"
 
@@ -18,80 +23,984 @@ typedef enum
 	Exited = 3,
 } state;
 
+/*
+ * The fields read by the scheduler for every thread it looks at come first and
+ * share a single cache line, so that walking many threads touches one line per
+ * thread. The context, with its large FPU area only read by the switch itself,
+ * comes last.
+ */
 struct uthread_tcb
 {
-	uthread_ctx_t ctx;
+	/* Hot: scheduler state, switch mode, ready queue link and stack */
+	_Alignas(POOL_CACHE_LINE) state state;
+	int priority;
+	uint32_t id;
+	bool integer_only;
+	bool ctx_int;
+	queue_handle_t ready_handle;
+	uint64_t state_since;
 	void *stack;
-	state state;
+	size_t stack_size;
+
+	/* Cold: statistics, bookkeeping and debug information */
+	_Alignas(POOL_CACHE_LINE) uthread_thread_stats_t stats;
+	uthread_stack_mode_t stack_mode;
+	bool stack_owned;
+	size_t stack_high_water;
+	size_t stack_released;
+	uint64_t stack_released_at;
+	struct uthread_tcb *list_prev;
+	struct uthread_tcb *list_next;
+	struct uthread_batch *batch;
+	struct arena_chunk *arena;
+	void *keys[UTHREAD_KEYS_INLINE];
+	void **keys_overflow;
+	size_t keys_overflow_len;
+	char name[UTHREAD_NAME_LEN];
+	uthread_ctx_t ctx;
+};
+
+_Static_assert(offsetof(struct uthread_tcb, stats) == POOL_CACHE_LINE,
+	       "scheduler fields of the TCB must fit in a cache line");
+
+/*
+ * Memory shared by the threads created by uthread_create_batch(), freed with
+ * the last of them: their TCBs, and their stacks unless they are mapped
+ */
+struct uthread_batch
+{
+	size_t live;
+	void *stacks;
+	struct uthread_tcb threads[];
 };
 
-/* Create global queue for ready thread */
-queue_t ready_queue;
+/* Number of priority levels */
+#define PRIO_LEVELS (UTHREAD_PRIO_HIGH + 1)
+
+/* Create global queues for ready threads, one per priority level */
+static queue_t ready_queues[PRIO_LEVELS];
+
+/*
+ * Thread last unblocked by uthread_unblock(), run before the ready queue of
+ * its priority level while its working set is likely still in the cache
+ */
+static struct uthread_tcb *run_next;
+
+/*
+ * Consecutive threads taken from the run-next slot, which goes to the back of
+ * its queue past RUN_NEXT_STREAK so that threads waking each other up cannot
+ * starve the others
+ */
+#define RUN_NEXT_STREAK 8
+static unsigned int run_next_streak;
+
+/* Priority shared by the waiters given to uthread_unblock_all(), -1 if mixed */
+static int unblock_priority;
 
 struct uthread_tcb *current_thread;
 
+/* Identifier of the next created thread, the idle thread is 0 */
+static uint32_t next_id = 1;
+
+/* How the stacks of new threads are allocated */
+static uthread_stack_mode_t stack_mode = UTHREAD_STACK_HEAP;
+static size_t lazy_stack_size = UTHREAD_LAZY_STACK_SIZE;
+static size_t huge_stack_size = UTHREAD_STACK_SIZE;
+
+/* Threads created and not exited yet, to walk over their stacks */
+static struct uthread_tcb *thread_list;
+
+/*
+ * Blocked time after which stacks are shrunk, earliest time of the next sweep
+ * by the idle thread, and whether Blocked threads may need one
+ */
+static uint64_t stack_release_ns = UTHREAD_STACK_RELEASE_NS;
+static uint64_t stack_sweep_at;
+static bool stack_sweep_pending;
+
+/* Last exited thread, whose stack may still be in use until the next switch */
+static struct uthread_tcb *exited_thread;
+
+/* Thread-local storage keys created so far, and their destructors */
+static uthread_key_t key_count;
+static void (*key_destructors[UTHREAD_KEYS_MAX])(void *);
+
+/* Scheduler-wide statistics, and whether the current switch is a preemption */
+static uthread_stats_t sched_stats;
+static bool preempting;
+
+/*
+ * Signal mask of every voluntary switch, given to the contexts saved without
+ * their signal mask when they are resumed with it
+ */
+static sigset_t switch_mask;
+
+/* Number of Blocked threads, to detect deadlocks */
+static size_t blocked_count;
+
+/* Time at which the threads given to uthread_unblock_all() become Ready */
+static uint64_t unblock_now;
+
+uint64_t uthread_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Add the time spent in @current_state since @since to @stats */
+static void uthread_account_period(uthread_thread_stats_t *stats, state current_state,
+				   uint64_t since, uint64_t now)
+{
+	uint64_t elapsed = now - since;
+
+	switch (current_state)
+	{
+	case Running:
+		stats->cpu_ns += elapsed;
+		break;
+	case Ready:
+		stats->ready_ns += elapsed;
+		break;
+	case Blocked:
+		stats->blocked_ns += elapsed;
+		break;
+	default:
+		break;
+	}
+}
+
+/* Account the time since @thread entered its current state, at time @now */
+static void uthread_account(struct uthread_tcb *thread, uint64_t now)
+{
+	uthread_account_period(&thread->stats, thread->state, thread->state_since, now);
+	thread->state_since = now;
+}
+
+void uthread_account_sem_wait(uint64_t ns)
+{
+	current_thread->stats.sem_wait_ns += ns;
+}
+
+int uthread_get_thread_stats(uthread_t thread, uthread_thread_stats_t *stats)
+{
+	state current_state;
+	uint64_t since;
+
+	if (!thread)
+	{
+		thread = current_thread;
+	}
+	if (!thread || !stats)
+	{
+		return -1;
+	}
+
+	/* Include the current period without changing the thread itself */
+	preempt_disable();
+	current_state = thread->state;
+	since = thread->state_since;
+	*stats = thread->stats;
+	preempt_enable();
+	uthread_account_period(stats, current_state, since, uthread_clock_ns());
+	return 0;
+}
+
+int uthread_stats(uthread_stats_t *stats)
+{
+	if (!stats)
+	{
+		return -1;
+	}
+
+	preempt_disable();
+	*stats = sched_stats;
+	preempt_enable();
+	return 0;
+}
+
+uint32_t uthread_id(struct uthread_tcb *uthread)
+{
+	return uthread->id;
+}
+
+int uthread_key_create(uthread_key_t *key, void (*destructor)(void *))
+{
+	if (!key)
+	{
+		return -1;
+	}
+
+	preempt_disable();
+	if (key_count == UTHREAD_KEYS_MAX)
+	{
+		preempt_enable();
+		return -1;
+	}
+	key_destructors[key_count] = destructor;
+	*key = key_count++;
+	preempt_enable();
+
+	return 0;
+}
+
+void *uthread_getspecific(uthread_key_t key)
+{
+	struct uthread_tcb *curr = current_thread;
+
+	if (key < UTHREAD_KEYS_INLINE)
+	{
+		return curr->keys[key];
+	}
+
+	key -= UTHREAD_KEYS_INLINE;
+	return key < curr->keys_overflow_len ? curr->keys_overflow[key] : NULL;
+}
+
+int uthread_setspecific(uthread_key_t key, const void *value)
+{
+	struct uthread_tcb *curr = current_thread;
+	size_t len;
+	void **table;
+
+	if (key >= key_count)
+	{
+		return -1;
+	}
+
+	if (key < UTHREAD_KEYS_INLINE)
+	{
+		curr->keys[key] = (void *)value;
+		return 0;
+	}
+
+	/* Grow the overflow table to the next power of two holding @key */
+	key -= UTHREAD_KEYS_INLINE;
+	if (key >= curr->keys_overflow_len)
+	{
+		if (!value)
+		{
+			return 0;
+		}
+
+		len = curr->keys_overflow_len ? curr->keys_overflow_len : UTHREAD_KEYS_INLINE;
+		while (len <= key)
+		{
+			len *= 2;
+		}
+
+		/* A thread preempted inside malloc would hold its lock */
+		preempt_defer_begin();
+		table = realloc(curr->keys_overflow, len * sizeof(void *));
+		preempt_defer_end();
+		if (!table)
+		{
+			return -1;
+		}
+		memset(table + curr->keys_overflow_len, 0,
+		       (len - curr->keys_overflow_len) * sizeof(void *));
+		curr->keys_overflow = table;
+		curr->keys_overflow_len = len;
+	}
+	curr->keys_overflow[key] = (void *)value;
+	return 0;
+}
+
+/* Run the destructors of the keys set by @thread, then free its key table */
+static void uthread_keys_destroy(struct uthread_tcb *thread)
+{
+	uthread_key_t key;
+	bool again = true;
+	void *value;
+	int pass;
+
+	for (pass = 0; pass < UTHREAD_DESTRUCTOR_ITERATIONS && again; pass++)
+	{
+		again = false;
+		for (key = 0; key < key_count; key++)
+		{
+			value = uthread_getspecific(key);
+			if (!value || !key_destructors[key])
+			{
+				continue;
+			}
+
+			uthread_setspecific(key, NULL);
+			key_destructors[key](value);
+			again = true;
+		}
+	}
+
+	preempt_defer_begin();
+	free(thread->keys_overflow);
+	preempt_defer_end();
+	thread->keys_overflow = NULL;
+	thread->keys_overflow_len = 0;
+}
+
 struct uthread_tcb *uthread_current(void)
 {
 	return current_thread;
 }
 
+struct arena_chunk **uthread_arena(void)
+{
+	return current_thread ? &current_thread->arena : NULL;
+}
+
+uthread_t uthread_self(void)
+{
+	return current_thread;
+}
+
+const char *uthread_get_name(uthread_t thread)
+{
+	if (!thread)
+	{
+		thread = current_thread;
+	}
+
+	return thread ? thread->name : NULL;
+}
+
+void uthread_attr_init(uthread_attr_t *attr)
+{
+	attr->stack_size = 0;
+	attr->stack_addr = NULL;
+	attr->priority = UTHREAD_PRIO_NORMAL;
+	attr->worker = UTHREAD_WORKER_ANY;
+	attr->name = NULL;
+	attr->integer_only = false;
+}
+
+int uthread_set_stack_mode(uthread_stack_mode_t mode, size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	if (mode != UTHREAD_STACK_HEAP && mode != UTHREAD_STACK_LAZY && mode != UTHREAD_STACK_HUGE)
+	{
+		return -1;
+	}
+
+	/* Mapped stacks must span whole pages */
+	size = (size + page - 1) / page * page;
+	if (mode == UTHREAD_STACK_HUGE &&
+	    (size > UTHREAD_HUGE_ARENA_SIZE - page || !uthread_ctx_huge_pages()))
+	{
+		return -1;
+	}
+
+	stack_mode = mode;
+	if (mode == UTHREAD_STACK_LAZY)
+	{
+		lazy_stack_size = size ? size : UTHREAD_LAZY_STACK_SIZE;
+	}
+	else if (mode == UTHREAD_STACK_HUGE)
+	{
+		huge_stack_size = size ? size : UTHREAD_STACK_SIZE;
+	}
+	return 0;
+}
+
+/*
+ * Allocate the stack of @thread according to the current stack mode, unless
+ * @attr provides the stack memory. A stack size of 0 in @attr selects the
+ * default size of the mode.
+ */
+static int uthread_stack_alloc(struct uthread_tcb *thread, const uthread_attr_t *attr)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	thread->stack_mode = stack_mode;
+	thread->stack_owned = true;
+
+	if (attr->stack_addr)
+	{
+		/* Caller-provided memory is never freed by the library */
+		thread->stack = attr->stack_addr;
+		thread->stack_size = attr->stack_size;
+		thread->stack_owned = false;
+	}
+	else if (stack_mode == UTHREAD_STACK_LAZY)
+	{
+		thread->stack_size = attr->stack_size ? (attr->stack_size + page - 1) / page * page : lazy_stack_size;
+		thread->stack = uthread_ctx_map_stack(thread->stack_size);
+		if (thread->stack)
+		{
+			worker_bind(thread->stack, thread->stack_size);
+		}
+	}
+	else if (stack_mode == UTHREAD_STACK_HUGE)
+	{
+		thread->stack_size = attr->stack_size ? (attr->stack_size + page - 1) / page * page : huge_stack_size;
+		thread->stack = thread->stack_size <= UTHREAD_HUGE_ARENA_SIZE - page ?
+			uthread_ctx_alloc_huge_stack(thread->stack_size) : NULL;
+	}
+	else
+	{
+		thread->stack_size = attr->stack_size ? attr->stack_size : UTHREAD_STACK_SIZE;
+		thread->stack = uthread_ctx_alloc_stack(thread->stack_size);
+	}
+
+	return thread->stack ? 0 : -1;
+}
+
+/* Free the stack of @thread, the way it was allocated */
+static void uthread_stack_free(struct uthread_tcb *thread)
+{
+	if (!thread->stack_owned)
+	{
+		return;
+	}
+
+	if (thread->stack_mode == UTHREAD_STACK_LAZY)
+	{
+		uthread_ctx_unmap_stack(thread->stack, thread->stack_size);
+	}
+	else if (thread->stack_mode == UTHREAD_STACK_HUGE)
+	{
+		uthread_ctx_free_huge_stack(thread->stack);
+	}
+	else
+	{
+		uthread_ctx_destroy_stack(thread->stack);
+	}
+}
+
+/* Add @thread to the list of live threads */
+static void thread_list_add(struct uthread_tcb *thread)
+{
+	thread->list_prev = NULL;
+	thread->list_next = thread_list;
+	if (thread_list)
+	{
+		thread_list->list_prev = thread;
+	}
+	thread_list = thread;
+}
+
+/* Remove @thread from the list of live threads */
+static void thread_list_remove(struct uthread_tcb *thread)
+{
+	if (thread->list_prev)
+	{
+		thread->list_prev->list_next = thread->list_next;
+	}
+	else
+	{
+		thread_list = thread->list_next;
+	}
+	if (thread->list_next)
+	{
+		thread->list_next->list_prev = thread->list_prev;
+	}
+}
+
+/*
+ * Stack pointer of @thread, which is the current one if @thread is running,
+ * NULL if unknown. Also raises the high-water mark of @thread up to it.
+ */
+static char *uthread_stack_pointer(struct uthread_tcb *thread)
+{
+	char *sp = thread == current_thread ? __builtin_frame_address(0) :
+		uthread_ctx_stack_pointer(&thread->ctx);
+	char *top = (char *)thread->stack + thread->stack_size;
+
+	if (!sp || sp < (char *)thread->stack || sp > top)
+	{
+		return NULL;
+	}
+	if ((size_t)(top - sp) > thread->stack_high_water)
+	{
+		thread->stack_high_water = top - sp;
+	}
+	return sp;
+}
+
+/*
+ * Raise the high-water mark of @thread up to its lowest resident page @lowest
+ * if its stack is mapped, as pages are only resident once touched
+ */
+static void uthread_stack_touched(struct uthread_tcb *thread, char *lowest)
+{
+	char *top = (char *)thread->stack + thread->stack_size;
+
+	if (thread->stack_mode != UTHREAD_STACK_LAZY || !lowest)
+	{
+		return;
+	}
+	if (lowest < (char *)thread->stack)
+	{
+		lowest = thread->stack;
+	}
+	if ((size_t)(top - lowest) > thread->stack_high_water)
+	{
+		thread->stack_high_water = top - lowest;
+	}
+}
+
+/*
+ * Give the unused pages of the stack of Blocked @thread back to the kernel,
+ * at time @now. Return the number of resident bytes given back.
+ */
+static size_t uthread_stack_shrink(struct uthread_tcb *thread, uint64_t now)
+{
+	size_t released;
+	void *lowest;
+	char *sp;
+
+	/*
+	 * Leave the stacks provided by the caller alone, and those on huge
+	 * pages, which releasing part of would split
+	 */
+	thread->stack_released_at = now;
+	if (!thread->stack || (!thread->stack_owned && !thread->batch) ||
+	    thread->stack_mode == UTHREAD_STACK_HUGE)
+	{
+		return 0;
+	}
+	sp = uthread_stack_pointer(thread);
+	if (!sp)
+	{
+		return 0;
+	}
+
+	/* Record how deep a mapped stack went before its pages are dropped */
+	if (thread->stack_mode == UTHREAD_STACK_LAZY)
+	{
+		uthread_ctx_stack_resident(thread->stack, sp, &lowest);
+		uthread_stack_touched(thread, lowest);
+	}
+	released = uthread_ctx_release_stack(thread->stack, sp);
+	thread->stack_released += released;
+	return released;
+}
+
+/*
+ * Shrink the stacks of the threads Blocked for at least @blocked_ns at time
+ * @now, unless already done since they blocked. Return the number of resident
+ * bytes given back, and tell in @pending whether other Blocked threads are to
+ * be shrunk later. Preemption must be disabled.
+ */
+static size_t uthread_stack_sweep(uint64_t blocked_ns, uint64_t now, bool *pending)
+{
+	struct uthread_tcb *thread;
+	size_t released = 0;
+
+	*pending = false;
+	for (thread = thread_list; thread; thread = thread->list_next)
+	{
+		if (thread->state != Blocked || thread->stack_released_at > thread->state_since)
+		{
+			continue;
+		}
+		if (now - thread->state_since >= blocked_ns)
+		{
+			released += uthread_stack_shrink(thread, now);
+		}
+		else
+		{
+			*pending = true;
+		}
+	}
+
+	return released;
+}
+
+size_t uthread_stack_release(uint64_t blocked_ns)
+{
+	size_t released;
+	bool pending;
+
+	preempt_disable();
+	released = uthread_stack_sweep(blocked_ns, uthread_clock_ns(), &pending);
+	preempt_enable();
+
+	return released;
+}
+
+void uthread_set_stack_release(uint64_t blocked_ns)
+{
+	stack_release_ns = blocked_ns;
+}
+
+int uthread_get_stack_stats(uthread_t thread, uthread_stack_stats_t *stats)
+{
+	void *lowest;
+	char *sp;
+
+	if (!thread)
+	{
+		thread = current_thread;
+	}
+	if (!thread || !thread->stack || !stats)
+	{
+		return -1;
+	}
+
+	preempt_disable();
+	sp = uthread_stack_pointer(thread);
+	stats->size = thread->stack_size;
+	stats->used = sp ? (size_t)((char *)thread->stack + thread->stack_size - sp) : 0;
+	stats->resident = uthread_ctx_stack_resident(thread->stack,
+						     (char *)thread->stack + thread->stack_size,
+						     &lowest);
+	uthread_stack_touched(thread, lowest);
+	stats->high_water = thread->stack_high_water;
+	stats->released = thread->stack_released;
+	preempt_enable();
+
+	return 0;
+}
+
+/* Free the stack and TCB of @thread, the way they were allocated */
+static void uthread_tcb_free(struct uthread_tcb *thread)
+{
+	struct uthread_batch *batch = thread->batch;
+
+	uthread_stack_free(thread);
+	if (!batch)
+	{
+		pool_free(thread);
+	}
+	else if (--batch->live == 0)
+	{
+		free(batch->stacks);
+		free(batch);
+	}
+}
+
+/* Free the stack and TCB of the last exited thread, once it is not running */
+static void uthread_reap(void)
+{
+	if (exited_thread && exited_thread != current_thread)
+	{
+		uthread_tcb_free(exited_thread);
+		exited_thread = NULL;
+	}
+}
+
+/* Push @thread in the ready queue of its priority level */
+static int ready_push(struct uthread_tcb *thread)
+{
+	thread->ready_handle = queue_enqueue_handle(ready_queues[thread->priority], thread);
+	return thread->ready_handle ? 0 : -1;
+}
+
+/* Put @thread in the run-next slot, moving the thread it held to its queue */
+static void run_next_push(struct uthread_tcb *thread)
+{
+	if (run_next)
+	{
+		ready_push(run_next);
+	}
+	run_next = thread;
+}
+
+/*
+ * Pop the Ready thread of the run-next slot or else the oldest one of the
+ * highest priority level, NULL if none. The slot never runs before a thread
+ * of a higher priority.
+ */
+static struct uthread_tcb *ready_pop(void)
+{
+	struct uthread_tcb *next;
+	int prio;
+
+	/* Let the queue run after a streak of run-next threads */
+	if (run_next && run_next_streak >= RUN_NEXT_STREAK)
+	{
+		ready_push(run_next);
+		run_next = NULL;
+	}
+
+	for (prio = PRIO_LEVELS - 1; prio >= 0; prio--)
+	{
+		if (run_next && run_next->priority == prio)
+		{
+			next = run_next;
+			run_next = NULL;
+			if (next->state == Ready)
+			{
+				run_next_streak++;
+				return next;
+			}
+		}
+
+		while (queue_dequeue(ready_queues[prio], (void **)&next) == 0)
+		{
+			/* Skip stale entries of threads that are not Ready anymore */
+			next->ready_handle = NULL;
+			if (next->state == Ready)
+			{
+				run_next_streak = 0;
+				return next;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* Number of threads in the run-next slot and all the ready queues */
+static int ready_length(void)
+{
+	int len = run_next ? 1 : 0;
+	int prio;
+
+	for (prio = 0; prio < PRIO_LEVELS; prio++)
+	{
+		len += queue_length(ready_queues[prio]);
+	}
+
+	return len;
+}
+
+/*
+ * Switch from @curr to @next, which is taken out of the ready queues, counting
+ * the switch as involuntary if @preempted. Preemption must be disabled.
+ */
+static void uthread_switch(struct uthread_tcb *curr, struct uthread_tcb *next, bool preempted)
+{
+	uint64_t now;
+
+	/*
+	 * Account the time @next waited, and the time @curr ran until now,
+	 * whatever state it is leaving the processor in
+	 */
+	now = uthread_clock_ns();
+	curr->stats.cpu_ns += now - curr->state_since;
+	curr->state_since = now;
+	uthread_account(next, now);
+	next->state = Running;
+
+	if (preempted)
+	{
+		curr->stats.involuntary_switches++;
+	}
+	else
+	{
+		curr->stats.voluntary_switches++;
+	}
+	sched_stats.context_switches++;
+
+	/* Reset New Current Thread */
+	TRACE(TRACE_SWITCH, curr->id, next->id, NULL);
+	current_thread = next;
+
+	/*
+	 * Context Switch, integer-only threads only save their integer state.
+	 * A preempted thread switches from the signal handler, whose signal mask
+	 * must be saved with it rather than inherited by @next.
+	 */
+	if (curr->integer_only && !preempted)
+	{
+		curr->ctx_int = true;
+		uthread_ctx_switch_int(&curr->ctx, &next->ctx, next->ctx_int);
+	}
+	else
+	{
+		curr->ctx_int = false;
+		if (next->ctx_int)
+		{
+			next->ctx.uc_sigmask = switch_mask;
+		}
+		uthread_ctx_switch(&curr->ctx, &next->ctx);
+	}
+}
+
 void uthread_yield(void)
 {
 	struct uthread_tcb *curr = uthread_current();
 	struct uthread_tcb *next;
+	uint64_t runqueue;
+	bool preempted;
 
 	/* Preempt Disable */
 	preempt_disable();
+	preempted = preempting;
+	preempting = false;
 
-	/* Pick New Thread to Run */
-	queue_dequeue(ready_queue, (void **)&next);
-	while (next->state != Ready)
+	/* Free the previous exited thread now that we are off its stack */
+	uthread_reap();
+
+	/* Wake the threads whose timer expired or whose file is ready */
+	if (event_waiting())
 	{
-		queue_enqueue(ready_queue, next);
-		queue_dequeue(ready_queue, (void **)&next);
+		event_poll();
+	}
+
+	/* Sample the number of threads waiting for the processor */
+	runqueue = ready_length();
+	sched_stats.runqueue_samples++;
+	sched_stats.runqueue_total += runqueue;
+	if (runqueue > sched_stats.runqueue_max)
+	{
+		sched_stats.runqueue_max = runqueue;
 	}
-	next->state = Running;
 
 	/* Save Current Thread's state if it is Running */
 	if (curr->state == Running)
 	{
 		curr->state = Ready;
-		queue_enqueue(ready_queue, curr);
+		ready_push(curr);
 	}
 
-	/* Reset New Current Thread */
-	current_thread = next;
+	/*
+	 * Pick New Thread to Run, which is the oldest thread of the highest
+	 * priority. This may be the current thread if nobody else is eligible.
+	 */
+	next = ready_pop();
+	assert(next);
+	if (next == curr)
+	{
+		next->state = Running;
+		preempt_enable();
+		return;
+	}
+
+	uthread_switch(curr, next, preempted);
+
+	/* Enable preemption */
+	preempt_enable();
+}
+
+int uthread_yield_to(uthread_t target)
+{
+	struct uthread_tcb *curr = uthread_current();
+
+	/* Preempt Disable */
+	preempt_disable();
+
+	/* Only a thread waiting in a ready queue can be switched to */
+	if (!target || target->state != Ready)
+	{
+		preempt_enable();
+		return -1;
+	}
+	if (target == run_next)
+	{
+		run_next = NULL;
+	}
+	else if (target->ready_handle)
+	{
+		queue_remove_handle(ready_queues[target->priority], target->ready_handle);
+		target->ready_handle = NULL;
+	}
+	/* Threads moved in with queue_concat() have no handle, search for them */
+	else if (queue_delete(ready_queues[target->priority], target) != 0)
+	{
+		preempt_enable();
+		return -1;
+	}
+
+	/* Free the previous exited thread now that we are off its stack */
+	uthread_reap();
 
-	/* Context Switch */
-	uthread_ctx_switch(&curr->ctx, &next->ctx);
+	/* The current thread waits for its turn like in uthread_yield() */
+	curr->state = Ready;
+	ready_push(curr);
+	uthread_switch(curr, target, false);
 
 	/* Enable preemption */
 	preempt_enable();
+	return 0;
 }
 
 void uthread_exit(void)
 {
 	struct uthread_tcb *curr = uthread_current();
 
+	/* Destructors run as part of the thread, with preemption enabled */
+	uthread_keys_destroy(curr);
+
+	preempt_disable();
+
+	/* A task exiting on the stack of its carrier ends the carrier */
+	uthread_task_blocked(curr);
+
+	arena_free(&curr->arena);
+	TRACE(TRACE_EXIT, curr->id, 0, NULL);
+	sched_stats.threads_exited++;
 	curr->state = Exited;
+	thread_list_remove(curr);
 
-	/* Destroy stack of current thread */
-	uthread_ctx_destroy_stack(curr->stack);
+	/*
+	 * The stack of current thread cannot be destroyed while we are still
+	 * running on it, so it is freed by the next thread that yields
+	 */
+	uthread_reap();
+	exited_thread = curr;
 
 	/* We use uthread_yield because code is roughly the same */
 	uthread_yield();
 }
 
+/* Initialize the fields of a new Ready thread, apart from its stack */
+static void uthread_tcb_init(struct uthread_tcb *thread, const uthread_attr_t *attr, uint64_t now)
+{
+	thread->state = Ready;
+	thread->priority = attr->priority;
+	thread->id = next_id++;
+	thread->integer_only = attr->integer_only;
+	thread->ctx_int = false;
+	thread->state_since = now;
+	memset(&thread->stats, 0, sizeof(thread->stats));
+	memset(thread->keys, 0, sizeof(thread->keys));
+	thread->keys_overflow = NULL;
+	thread->keys_overflow_len = 0;
+	thread->stack_high_water = 0;
+	thread->stack_released = 0;
+	thread->stack_released_at = 0;
+	thread->batch = NULL;
+	thread->ready_handle = NULL;
+	thread->arena = NULL;
+	strncpy(thread->name, attr->name ? attr->name : "", UTHREAD_NAME_LEN - 1);
+	thread->name[UTHREAD_NAME_LEN - 1] = '\0';
+}
+
 int uthread_create(uthread_func_t func, void *arg)
 {
-	int init_value;
-	int enqueue_value;
+	return uthread_create_attr(NULL, NULL, func, arg);
+}
+
+int uthread_create_attr(uthread_t *handle, const uthread_attr_t *attr,
+			uthread_func_t func, void *arg)
+{
+	int retval;
 
-	/* Disable Preemption */
 	preempt_disable();
+	retval = uthread_create_locked(handle, attr, func, arg);
+	preempt_enable();
+
+	return retval;
+}
+
+int uthread_create_locked(uthread_t *handle, const uthread_attr_t *attr,
+			  uthread_func_t func, void *arg)
+{
+	uthread_attr_t defaults;
+	int init_value;
+	int enqueue_value = 0;
+
+	if (!attr)
+	{
+		uthread_attr_init(&defaults);
+		attr = &defaults;
+	}
+
+	/* Check the attributes */
+	if ((attr->stack_size && attr->stack_size < UTHREAD_STACK_MIN) ||
+	    (attr->stack_addr && !attr->stack_size) ||
+	    attr->priority < UTHREAD_PRIO_LOW || attr->priority > UTHREAD_PRIO_HIGH ||
+	    (attr->worker != UTHREAD_WORKER_ANY && attr->worker != 0))
+	{
+		return -1;
+	}
 
 	/* Create thread */
-	struct uthread_tcb *thread = malloc(sizeof(struct uthread_tcb));
+	struct uthread_tcb *thread = pool_alloc(sizeof(struct uthread_tcb));
 	if (!thread)
 	{
 		return -1;
@@ -99,53 +1008,332 @@ int uthread_create(uthread_func_t func, void *arg)
 
 	/* Initialize Thread */
 	/* We initialize the thread's stack first because it is a parameter in creating the context */
-	thread->stack = uthread_ctx_alloc_stack();
-	thread->state = Ready;
-	init_value = uthread_ctx_init(&thread->ctx, thread->stack, func, arg);
-
-	if (init_value != 0)
+	if (uthread_stack_alloc(thread, attr) != 0)
 	{
+		pool_free(thread);
 		return -1;
 	}
+	uthread_tcb_init(thread, attr, uthread_clock_ns());
+	init_value = uthread_ctx_init(&thread->ctx, thread->stack, thread->stack_size, func, arg);
 
 	/* Push thread in ready queue */
-	enqueue_value = queue_enqueue(ready_queue, thread);
-	if (enqueue_value != 0)
+	if (init_value == 0)
+	{
+		enqueue_value = ready_push(thread);
+	}
+
+	if (init_value != 0 || enqueue_value != 0)
+	{
+		uthread_tcb_free(thread);
+		return -1;
+	}
+
+	if (handle)
+	{
+		*handle = thread;
+	}
+	thread_list_add(thread);
+	TRACE(TRACE_CREATE, thread->id, current_thread->id, thread->name);
+	sched_stats.threads_created++;
+
+	return 0;
+}
+
+/*
+ * Allocate the stacks of the @n threads of @batch at once, according to the
+ * current stack mode
+ */
+static int uthread_batch_stacks(struct uthread_batch *batch, size_t n)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t size;
+	char *stacks;
+	size_t i;
+
+	if (stack_mode == UTHREAD_STACK_LAZY)
+	{
+		/* Every thread unmaps its own stack when it exits */
+		size = lazy_stack_size;
+		if (n > SIZE_MAX / (size + page))
+		{
+			return -1;
+		}
+		stacks = uthread_ctx_map_stacks(n, size);
+		if (!stacks)
+		{
+			return -1;
+		}
+		worker_bind(stacks - page, n * (size + page));
+		batch->stacks = NULL;
+	}
+	else if (stack_mode == UTHREAD_STACK_HUGE)
+	{
+		/* Arenas already group the stacks, every thread frees its own */
+		for (i = 0; i < n; i++)
+		{
+			batch->threads[i].stack_mode = stack_mode;
+			batch->threads[i].stack_owned = true;
+			batch->threads[i].stack_size = huge_stack_size;
+			batch->threads[i].stack = uthread_ctx_alloc_huge_stack(huge_stack_size);
+			if (!batch->threads[i].stack)
+			{
+				while (i-- > 0)
+				{
+					uthread_ctx_free_huge_stack(batch->threads[i].stack);
+				}
+				return -1;
+			}
+		}
+		batch->stacks = NULL;
+		return 0;
+	}
+	else
+	{
+		/* The stacks are freed with the batch */
+		size = UTHREAD_STACK_SIZE;
+		if (n > SIZE_MAX / size)
+		{
+			return -1;
+		}
+		stacks = uthread_ctx_alloc_stack(n * size);
+		if (!stacks)
+		{
+			return -1;
+		}
+		batch->stacks = stacks;
+	}
+
+	for (i = 0; i < n; i++)
 	{
+		batch->threads[i].stack_mode = stack_mode;
+		batch->threads[i].stack_owned = stack_mode == UTHREAD_STACK_LAZY;
+		batch->threads[i].stack_size = size;
+		batch->threads[i].stack = stack_mode == UTHREAD_STACK_LAZY ?
+			stacks + i * (size + page) : stacks + i * size;
+	}
+	return 0;
+}
+
+/* Free the threads of a batch that could not be started, and their queue */
+static void uthread_batch_abort(struct uthread_batch *batch, size_t n, queue_t threads)
+{
+	void *thread;
+	size_t i;
+
+	while (queue_dequeue(threads, &thread) == 0)
+	{
+		continue;
+	}
+	queue_destroy(threads);
+
+	for (i = 0; i < n; i++)
+	{
+		batch->threads[i].batch = batch;
+		uthread_tcb_free(&batch->threads[i]);
+	}
+}
+
+int uthread_create_batch(size_t n, uthread_func_t func, void *args[])
+{
+	struct uthread_batch *batch;
+	struct uthread_tcb *thread;
+	uthread_attr_t attr;
+	uthread_ctx_t model;
+	queue_t threads;
+	uint64_t now;
+	int retval;
+	size_t i;
+
+	if (!func)
+	{
+		return -1;
+	}
+	if (n == 0)
+	{
+		return 0;
+	}
+	if (n > (SIZE_MAX - sizeof(struct uthread_batch)) / sizeof(struct uthread_tcb))
+	{
+		return -1;
+	}
+
+	/* Disable Preemption, once for all the threads */
+	preempt_disable();
+
+	/* Both sizes are multiples of the cache line that the TCBs are aligned on */
+	batch = aligned_alloc(POOL_CACHE_LINE, sizeof(struct uthread_batch) + n * sizeof(struct uthread_tcb));
+	threads = queue_create();
+	if (!batch || !threads || uthread_batch_stacks(batch, n) != 0)
+	{
+		free(batch);
+		queue_destroy(threads);
+		preempt_enable();
+		return -1;
+	}
+	batch->live = n;
+
+	/* Every context starts as a copy of this one */
+	retval = getcontext(&model);
+
+	uthread_attr_init(&attr);
+	now = uthread_clock_ns();
+	for (i = 0; retval == 0 && i < n; i++)
+	{
+		thread = &batch->threads[i];
+		uthread_tcb_init(thread, &attr, now);
+		thread->batch = batch;
+		retval = uthread_ctx_init_from(&thread->ctx, &model, thread->stack, thread->stack_size,
+					       func, args ? args[i] : NULL);
+		if (retval == 0)
+		{
+			retval = queue_enqueue(threads, thread);
+		}
+	}
+
+	if (retval != 0)
+	{
+		uthread_batch_abort(batch, n, threads);
+		preempt_enable();
 		return -1;
 	}
 
+	/* Splice all the new threads onto the ready queue at once */
+	queue_concat(ready_queues[attr.priority], threads);
+	queue_destroy(threads);
+	for (i = 0; i < n; i++)
+	{
+		thread_list_add(&batch->threads[i]);
+		TRACE(TRACE_CREATE, batch->threads[i].id, current_thread->id, "");
+	}
+	sched_stats.threads_created += n;
+
 	/* Enable Preemption */
 	preempt_enable();
 
 	return 0;
 }
 
+/*
+ * Shrink the stacks of the threads blocked for long, at most once every
+ * stack_release_ns, then sleep until a thread can be woken up like
+ * event_wait(), or until the next sweep. Threads thus get their stack shrunk
+ * between one and two stack_release_ns after they block.
+ */
+static int uthread_idle(void)
+{
+	uint64_t now;
+
+	if (!stack_release_ns || !stack_sweep_pending)
+	{
+		return event_wait(0);
+	}
+
+	now = uthread_clock_ns();
+	if (now >= stack_sweep_at)
+	{
+		preempt_disable();
+		uthread_stack_sweep(stack_release_ns, now, &stack_sweep_pending);
+		preempt_enable();
+		stack_sweep_at = now + stack_release_ns;
+	}
+
+	return event_wait(stack_sweep_pending ? stack_sweep_at : 0);
+}
+
+/*
+ * Undo what uthread_run() set up, whether it got to run threads or failed on
+ * the way: free the last exited thread, the idle thread (if it was allocated)
+ * and the ready queues, stop preemption and restore the worker
+ */
+static void uthread_run_cleanup(struct uthread_tcb *idle)
+{
+	int prio;
+
+	preempt_disable();
+	uthread_reap();
+	current_thread = NULL;
+	if (idle)
+	{
+		free(idle->keys_overflow);
+		arena_free(&idle->arena);
+		pool_free(idle);
+	}
+	for (prio = 0; prio < PRIO_LEVELS; prio++)
+	{
+		if (ready_queues[prio])
+		{
+			queue_destroy(ready_queues[prio]);
+			ready_queues[prio] = NULL;
+		}
+	}
+	preempt_enable();
+
+	preempt_stop();
+	event_destroy();
+	worker_stop();
+}
+
 int uthread_run(bool preempt, uthread_func_t func, void *arg)
 {
 	int create_value;
+	int retval = 0;
+	int prio;
+
+	/* Pin the worker before any memory is allocated */
+	if (worker_start() != 0)
+	{
+		return -1;
+	}
+
+	if (event_init() != 0)
+	{
+		uthread_run_cleanup(NULL);
+		return -1;
+	}
 
 	/* Preempt Start */
 	preempt_start(preempt);
 
-	/* Create global queue */
-	ready_queue = queue_create();
+	/* Create global queues */
+	for (prio = 0; prio < PRIO_LEVELS; prio++)
+	{
+		ready_queues[prio] = queue_create();
+		if (!ready_queues[prio])
+		{
+			uthread_run_cleanup(NULL);
+			return -1;
+		}
+	}
 
 	/* Disable Preempt */
 	preempt_disable();
-
-	/* Initialize Current Thread */
-	current_thread = malloc(sizeof(struct uthread_tcb));
+	sigprocmask(SIG_BLOCK, NULL, &switch_mask);
 
 	/* Register Application as idle Thread */
-	struct uthread_tcb *idle = malloc(sizeof(struct uthread_tcb));
-	if (!idle || !ready_queue)
+	struct uthread_tcb *idle = pool_alloc(sizeof(struct uthread_tcb));
+	if (!idle)
 	{
+		uthread_run_cleanup(NULL);
 		return -1;
 	}
 
-	/* Set Idle Thread state to Ready */
+	/* Set Idle Thread state to Ready, it only runs when nothing else can */
 	idle->state = Running;
+	idle->priority = UTHREAD_PRIO_LOW;
+	idle->id = 0;
+	idle->integer_only = false;
+	idle->ctx_int = false;
+	idle->state_since = uthread_clock_ns();
+	memset(&idle->stats, 0, sizeof(idle->stats));
+	memset(idle->keys, 0, sizeof(idle->keys));
+	idle->keys_overflow = NULL;
+	idle->keys_overflow_len = 0;
+	idle->stack = NULL;
+	idle->stack_owned = false;
+	idle->batch = NULL;
+	idle->ready_handle = NULL;
+	idle->arena = NULL;
+	strcpy(idle->name, "idle");
 
 	/* Set Idle as Current Thread */
 	current_thread = idle;
@@ -161,51 +1349,168 @@ int uthread_run(bool preempt, uthread_func_t func, void *arg)
 
 	if (create_value == -1)
 	{
+		uthread_run_cleanup(idle);
 		return -1;
 	}
 
 	/* Enable Preempt */
 	preempt_enable();
 
-	/* Check for Ready Threads */
-	/* If there is nothing left in the ready queue, it should return 0, but should yield when there are still elements in the ready queue */
-	while (queue_length(ready_queue) >= 1)
+	/*
+	 * Yield while there are ready threads. Once there are none, sleep until
+	 * a thread can be woken up. When none can anymore, stop taking
+	 * submissions, and stop unless some came in the meantime.
+	 */
+	while (ready_length() >= 1 || uthread_idle() == 0 || event_close() == 0)
 	{
-		/* Yield if there are still available threads left */
-		uthread_yield();
+		if (ready_length() >= 1)
+		{
+			uthread_yield();
+		}
 	}
 
-	/* Free the queue memory */
-	queue_destroy(ready_queue);
+	/* Threads still blocked can never be woken up */
+	if (blocked_count > 0)
+	{
+		fprintf(stderr, "uthread: deadlock, %zu thread(s) blocked forever\n",
+			blocked_count);
+		blocked_count = 0;
+		thread_list = NULL;
+		stack_sweep_pending = false;
+		retval = -1;
+	}
 
-	/* Enable Preempt */
-	preempt_enable();
+	uthread_run_cleanup(idle);
+	return retval;
+}
 
-	/* Preempt Stop */
-	preempt_stop();
+void uthread_preempt(void)
+{
+	/*
+	 * A tick left pending while uthread_run() returns is delivered once
+	 * preemption is enabled again, with no thread left to preempt
+	 */
+	if (!current_thread)
+	{
+		return;
+	}
 
-	return 0;
+	preempt_disable();
+	TRACE(TRACE_PREEMPT, current_thread->id, 0, NULL);
+	sched_stats.preemptions++;
+	preempting = true;
+	uthread_yield();
 }
 
 void uthread_block(void)
 {
+	preempt_disable();
+
+	/* A task blocking on the stack of its carrier becomes a thread */
+	uthread_task_blocked(current_thread);
+
 	/* Change current state to blocked */
+	TRACE(TRACE_BLOCK, current_thread->id, 0, NULL);
 	current_thread->state = Blocked;
+	blocked_count++;
+	stack_sweep_pending = true;
 	uthread_yield();
 }
 
+/* Make @uthread Ready if it is blocked, before it is given to the scheduler */
+static void uthread_set_ready(struct uthread_tcb *uthread)
+{
+	/* Check if the current state is blocked */
+	if (uthread->state == Blocked)
+	{
+		uthread_account(uthread, uthread_clock_ns());
+		uthread->state = Ready;
+		blocked_count--;
+	}
+	TRACE(TRACE_UNBLOCK, uthread->id, current_thread->id, NULL);
+}
+
+bool uthread_wake(struct uthread_tcb *uthread)
+{
+	if (uthread->state != Blocked)
+	{
+		return false;
+	}
+
+	uthread_set_ready(uthread);
+	ready_push(uthread);
+	return true;
+}
+
 void uthread_unblock(struct uthread_tcb *uthread)
 {
 	/* Disable preempt */
 	preempt_disable();
 
-	/* Check if the current state is blocked */
+	/* A thread that is not blocked is already queued or running */
+	if (uthread->state != Blocked)
+	{
+		preempt_enable();
+		return;
+	}
+
+	/* The waker just handed data over, run the thread before the queue */
+	uthread_set_ready(uthread);
+	run_next_push(uthread);
+
+	/* Enable Preempt */
+	preempt_enable();
+}
+
+/* Helper function for uthread_unblock_all(), run on every waiting thread */
+static void unblock_helper(queue_t queue, void *data)
+{
+	struct uthread_tcb *uthread = (struct uthread_tcb *)data;
+	(void)queue;
+
 	if (uthread->state == Blocked)
 	{
+		uthread_account(uthread, unblock_now);
 		uthread->state = Ready;
+		blocked_count--;
+	}
+	TRACE(TRACE_UNBLOCK, uthread->id, current_thread->id, NULL);
+
+	/* Keep track of whether all the waiters have the same priority */
+	if (unblock_priority == PRIO_LEVELS)
+	{
+		unblock_priority = uthread->priority;
+	}
+	else if (unblock_priority != uthread->priority)
+	{
+		unblock_priority = -1;
+	}
+}
+
+void uthread_unblock_all(queue_t waiters)
+{
+	struct uthread_tcb *uthread;
+
+	/* Disable preempt */
+	preempt_disable();
+
+	/* Mark every waiter as Ready, then hand the whole list to the scheduler */
+	unblock_priority = PRIO_LEVELS;
+	unblock_now = uthread_clock_ns();
+	queue_iterate(waiters, unblock_helper);
+	if (unblock_priority >= 0 && unblock_priority < PRIO_LEVELS)
+	{
+		queue_concat(ready_queues[unblock_priority], waiters);
+	}
+	else
+	{
+		/* Mixed priorities, each waiter goes to its own ready queue */
+		while (queue_dequeue(waiters, (void **)&uthread) == 0)
+		{
+			ready_push(uthread);
+		}
 	}
-	queue_enqueue(ready_queue, uthread);
 
 	/* Enable Preempt */
 	preempt_enable();
-}
\ No newline at end of file
+}
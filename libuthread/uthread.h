@@ -2,6 +2,8 @@
 #define _UTHREAD_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /*
  * uthread_func_t - Thread function type
@@ -9,6 +11,160 @@
  */
 typedef void (*uthread_func_t)(void *arg);
 
+/*
+ * uthread_t - Thread handle
+ *
+ * Opaque handle to a thread, as returned by uthread_create_attr() or
+ * uthread_self(). A handle is only valid until its thread exits.
+ */
+typedef struct uthread_tcb *uthread_t;
+
+/*
+ * Thread priorities
+ *
+ * The scheduler always runs the oldest ready thread of the highest priority.
+ * Threads of a lower priority only run when no thread of a higher priority is
+ * ready. Threads created with uthread_create() have a normal priority.
+ */
+#define UTHREAD_PRIO_LOW	0
+#define UTHREAD_PRIO_NORMAL	1
+#define UTHREAD_PRIO_HIGH	2
+
+/* Worker affinity meaning the thread can run on any worker */
+#define UTHREAD_WORKER_ANY	-1
+
+/* Smallest stack size accepted in thread attributes (in bytes) */
+#define UTHREAD_STACK_MIN	8192
+
+/* Maximum length of a thread name, including the terminating null byte */
+#define UTHREAD_NAME_LEN	16
+
+/*
+ * uthread_attr_t - Thread attributes
+ * @stack_size: Size of the stack (in bytes), at least UTHREAD_STACK_MIN, or 0
+ *	for the default size of the current stack mode
+ * @stack_addr: Caller-provided stack memory of @stack_size bytes, or NULL for
+ *	the library to allocate it. Caller-provided memory is not freed when the
+ *	thread exits, and must stay valid until then.
+ * @priority: One of the UTHREAD_PRIO_* priorities
+ * @worker: Kernel worker the thread is bound to, or UTHREAD_WORKER_ANY. The
+ *	library runs all threads on a single worker, number 0.
+ * @name: Debug name of the thread, truncated to UTHREAD_NAME_LEN - 1
+ *	characters, or NULL
+ * @integer_only: Whether the thread leaves floating point alone, so that its
+ *	voluntary switches skip the floating point environment and the signal mask,
+ *	which costs no system call. Such a thread may still compute with floating
+ *	point as long as it keeps the default environment (rounding mode,
+ *	exception masks, ...): only that environment is lost across its switches,
+ *	the registers themselves are never live at a switch. It must not change
+ *	its signal mask either.
+ *
+ * Attributes must be initialized with uthread_attr_init() before setting the
+ * fields to change.
+ */
+typedef struct uthread_attr
+{
+	size_t stack_size;
+	void *stack_addr;
+	int priority;
+	int worker;
+	const char *name;
+	bool integer_only;
+} uthread_attr_t;
+
+/*
+ * uthread_stack_mode_t - Stack allocation mode
+ *
+ * UTHREAD_STACK_HEAP: each thread gets a 32 KiB stack allocated from the heap.
+ * This is the default.
+ *
+ * UTHREAD_STACK_LAZY: each thread gets a large stack (1 MiB by default) that is
+ * only reserved in the address space, with a guard page below it to catch
+ * overflows. Physical memory is committed by the kernel only for the pages a
+ * thread actually touches, so deep recursion is possible while mostly idle
+ * threads cost a page or two.
+ *
+ * UTHREAD_STACK_HUGE: each thread gets a stack (32 KiB by default) carved from
+ * 2 MiB arenas backed by huge pages, explicit ones if the system has some
+ * reserved (see /proc/sys/vm/nr_hugepages) or else transparent ones. With
+ * many threads switching constantly, the stacks of 63 threads then share a
+ * single TLB entry instead of taking at least one each. The memory of an arena
+ * is committed as a whole, and stacks have no guard page. Without huge pages,
+ * this mode cannot be selected, and thread creation fails if the huge pages
+ * run out: use UTHREAD_STACK_LAZY for guarded stacks instead.
+ */
+typedef enum
+{
+	UTHREAD_STACK_HEAP = 0,
+	UTHREAD_STACK_LAZY = 1,
+	UTHREAD_STACK_HUGE = 2,
+} uthread_stack_mode_t;
+
+/*
+ * uthread_set_stack_mode - Select how stacks of new threads are allocated
+ * @mode: Stack allocation mode
+ * @size: Size of the stacks for UTHREAD_STACK_LAZY and UTHREAD_STACK_HUGE (in
+ *	bytes), rounded up to the page size, or 0 for the default size. Ignored
+ *	for UTHREAD_STACK_HEAP.
+ *
+ * The mode applies to all the threads created afterwards. Threads created with
+ * a different mode keep their stack until they exit.
+ *
+ * Return: -1 if @mode is invalid, or for UTHREAD_STACK_HUGE if @size does not
+ * fit in a huge page or if the system has neither explicit huge pages reserved
+ * nor transparent huge pages enabled, 0 otherwise.
+ */
+int uthread_set_stack_mode(uthread_stack_mode_t mode, size_t size);
+
+/* Default time after which the stacks of blocked threads are shrunk (in ns) */
+#define UTHREAD_STACK_RELEASE_NS	1000000000
+
+/*
+ * uthread_set_stack_release - Select when the stacks of blocked threads shrink
+ * @blocked_ns: Time a thread must have been blocked for (in nanoseconds), or
+ *	0 to disable the automatic release
+ *
+ * When the worker runs out of ready threads, at most once every @blocked_ns,
+ * the library gives the pages of stack that threads blocked for at least
+ * @blocked_ns are not using back to the kernel, as with uthread_stack_release().
+ * A thread that stays blocked thus gets its stack shrunk within about twice
+ * @blocked_ns, even if the worker is sleeping. This lets the memory used by a
+ * burst of deep calls go back once the threads are parked. Defaults to
+ * UTHREAD_STACK_RELEASE_NS.
+ */
+void uthread_set_stack_release(uint64_t blocked_ns);
+
+/*
+ * uthread_stack_release - Shrink the stacks of blocked threads
+ * @blocked_ns: Time a thread must have been blocked for (in nanoseconds)
+ *
+ * Give the pages below the stack pointer of every thread blocked for at least
+ * @blocked_ns back to the kernel with madvise(MADV_DONTNEED). They read as
+ * zeros when touched again, which only costs a page fault. Stacks provided by
+ * the caller with uthread_attr_t are left alone, and so is every stack on
+ * architectures where the library cannot find the stack pointer of a thread.
+ *
+ * Return: Number of resident bytes given back
+ */
+size_t uthread_stack_release(uint64_t blocked_ns);
+
+/*
+ * uthread_set_worker_placement - Place the worker on a CPU and NUMA node
+ * @cpu: CPU the worker is pinned to, or -1 to leave it unpinned
+ * @node: NUMA node the lazily committed stacks are bound to, or -1 to let
+ *	the kernel place them where they are first touched
+ *
+ * The worker is the kernel thread calling uthread_run(): it is pinned to @cpu
+ * for the duration of the call, and its previous affinity is restored when
+ * uthread_run() returns. With the worker pinned, the TCBs, heap stacks and
+ * lazy stacks are first touched from @cpu, and so come from its local node
+ * unless @node says otherwise. Memory is bound with a preferred policy, so it
+ * still comes from another node when @node runs out.
+ *
+ * Return: 0 in case of success, -1 if @cpu or @node is out of range
+ */
+int uthread_set_worker_placement(int cpu, int node);
+
 /*
  * uthread_run - Run the multithreading library
  * @preempt: Preemption enable
@@ -21,8 +177,15 @@ typedef void (*uthread_func_t)(void *arg);
  *
  * If @preempt is `true`, then preemptive scheduling is enabled.
  *
- * Return: 0 in case of success, -1 in case of failure (e.g., memory allocation,
- * context creation).
+ * When no thread is ready, the calling thread sleeps in the kernel until a
+ * sleeping thread's time is up, a file descriptor is ready or a function is
+ * submitted (see uthread_sleep(), uthread_wait_fd() and uthread_submit()). If
+ * nothing can wake the blocked threads up anymore (e.g., they all wait on
+ * semaphores), they are deadlocked: this is reported on the standard error and
+ * the function returns, abandoning them.
+ *
+ * Return: 0 in case of success, -1 in case of deadlock or failure (e.g.,
+ * memory allocation, context creation).
  */
 int uthread_run(bool preempt, uthread_func_t func, void *arg);
 
@@ -39,6 +202,64 @@ int uthread_run(bool preempt, uthread_func_t func, void *arg);
  */
 int uthread_create(uthread_func_t func, void *arg);
 
+/*
+ * uthread_attr_init - Initialize thread attributes
+ * @attr: Attributes to initialize
+ *
+ * Set @attr to the attributes used by uthread_create(): default stack size,
+ * stack allocated by the library, normal priority, any worker and no name.
+ */
+void uthread_attr_init(uthread_attr_t *attr);
+
+/*
+ * uthread_create_attr - Create a new thread with attributes
+ * @handle: Address where the handle of the new thread is received, or NULL
+ * @attr: Attributes of the new thread, or NULL for the default attributes
+ * @func: Function to be executed by the thread
+ * @arg: Argument to be passed to the thread
+ *
+ * Same as uthread_create(), with the stack, priority, worker and name of the
+ * new thread given by @attr.
+ *
+ * Return: 0 in case of success, -1 in case of invalid attributes or failure
+ * (e.g., memory allocation, context creation).
+ */
+int uthread_create_attr(uthread_t *handle, const uthread_attr_t *attr,
+			uthread_func_t func, void *arg);
+
+/*
+ * uthread_create_batch - Create many threads at once
+ * @n: Number of threads to create
+ * @func: Function to be executed by every thread
+ * @args: Array of the @n arguments to be passed to the threads, or NULL to
+ *	pass NULL to all of them
+ *
+ * Same as @n calls to uthread_create(), at a lower cost: the TCBs and the
+ * stacks are allocated in bulk, preemption is disabled once, and the threads
+ * are added to the ready queue in a single operation, in the order of @args.
+ * The TCBs, and the stacks unless they are lazily committed (see
+ * uthread_set_stack_mode()), are freed once all the threads have exited.
+ *
+ * Return: 0 in case of success, -1 if @func is NULL or in case of failure
+ * (e.g., memory allocation), in which case no thread is created
+ */
+int uthread_create_batch(size_t n, uthread_func_t func, void *args[]);
+
+/*
+ * uthread_self - Get the handle of the running thread
+ *
+ * Return: Handle of the currently running thread
+ */
+uthread_t uthread_self(void);
+
+/*
+ * uthread_get_name - Get the debug name of a thread
+ * @thread: Thread handle, or NULL for the running thread
+ *
+ * Return: Name of @thread, empty if it was not given one
+ */
+const char *uthread_get_name(uthread_t thread);
+
 /*
  * uthread_yield - Yield execution
  *
@@ -47,6 +268,20 @@ int uthread_create(uthread_func_t func, void *arg);
  */
 void uthread_yield(void);
 
+/*
+ * uthread_yield_to - Yield execution to a specific thread
+ * @target: Handle of the thread to run next, which must not have exited
+ *
+ * Switch straight to @target, regardless of its priority and of its position
+ * in the ready queue, and put the currently running thread back in the ready
+ * queue as uthread_yield() does. This is useful when a thread knows which one
+ * should run next, e.g., to hand a request over to the thread serving it.
+ *
+ * Return: 0 once the calling thread runs again, -1 if @target is NULL or is
+ * not ready to run (e.g., blocked, running)
+ */
+int uthread_yield_to(uthread_t target);
+
 /*
  * uthread_exit - Exit from currently running thread
  *
@@ -57,4 +292,261 @@ void uthread_yield(void);
  */
 void uthread_exit(void);
 
+/*
+ * uthread_sleep - Sleep for some time
+ * @ns: Time to sleep (in nanoseconds)
+ *
+ * Block the running thread for at least @ns nanoseconds. Other threads run in
+ * the meantime; if none is ready, the process sleeps in the kernel.
+ *
+ * Return: 0 in case of success, -1 in case of failure (e.g., memory allocation)
+ */
+int uthread_sleep(uint64_t ns);
+
+/*
+ * uthread_wait_fd - Wait for a file descriptor to be ready
+ * @fd: File descriptor
+ * @events: Events to wait for, as for poll(2) (e.g., POLLIN, POLLOUT)
+ *
+ * Block the running thread until @fd is ready for one of @events. While other
+ * threads run, file descriptors are polled about once per millisecond; when no
+ * thread is ready, the process sleeps in the kernel until one of them is.
+ *
+ * Return: Events that occurred on @fd, as the revents of poll(2), or -1 in
+ * case of failure (e.g., invalid @fd, memory allocation)
+ */
+int uthread_wait_fd(int fd, short events);
+
+/*
+ * uthread_submit - Submit a function from another kernel thread
+ * @func: Function to be executed by a new thread
+ * @arg: Argument to be passed to the thread
+ *
+ * Unlike the other functions of the library, this one can be called from any
+ * kernel thread (e.g., a pthread doing blocking I/O), while uthread_run() is
+ * running. A new thread running @func is created by the idle thread, which is
+ * woken up if it sleeps.
+ *
+ * The calling kernel thread must not run uthread threads itself, nor call the
+ * other functions of the library. It does not need to block the preemption
+ * signal: the preemption timer only signals the worker.
+ *
+ * Return: 0 in case of success, in which case @func is sure to run, -1 if
+ * @func is NULL, if uthread_run() is not running or is about to return (no
+ * thread left and no hold), or in case of failure (e.g., memory allocation)
+ */
+int uthread_submit(uthread_func_t func, void *arg);
+
+/*
+ * uthread_hold - Keep uthread_run() waiting for submissions
+ *
+ * uthread_run() returns once no thread can run anymore. A hold keeps it
+ * sleeping instead, waiting for functions given to uthread_submit(), until it
+ * is released with uthread_release(). Can be called from any kernel thread.
+ */
+void uthread_hold(void);
+
+/*
+ * uthread_release - Release a hold taken with uthread_hold()
+ */
+void uthread_release(void);
+
+/*
+ * uthread_key_t - Thread-local storage key
+ *
+ * A key designates one value per thread, NULL until the thread sets it. The
+ * first UTHREAD_KEYS_INLINE keys are stored in the TCB itself, further keys in
+ * a table allocated when the thread first sets them.
+ */
+typedef unsigned int uthread_key_t;
+
+/* Number of keys stored in the TCB, and maximum number of keys */
+#define UTHREAD_KEYS_INLINE	8
+#define UTHREAD_KEYS_MAX	1024
+
+/*
+ * uthread_key_create - Create a thread-local storage key
+ * @key: Address where the new key is received
+ * @destructor: Function called with the value of a thread when it exits, or
+ *	NULL
+ *
+ * When a thread exits, @destructor is called for every key whose value is not
+ * NULL in the thread, with the value reset to NULL beforehand. If destructors
+ * set new values, they are called again, up to UTHREAD_DESTRUCTOR_ITERATIONS
+ * times. Keys cannot be deleted.
+ *
+ * Tasks (see task.h) share the thread-local storage of the thread running them.
+ *
+ * Return: 0 in case of success, -1 if @key is NULL or if UTHREAD_KEYS_MAX keys
+ * were already created
+ */
+int uthread_key_create(uthread_key_t *key, void (*destructor)(void *));
+
+/* Maximum number of passes over the destructors when a thread exits */
+#define UTHREAD_DESTRUCTOR_ITERATIONS	4
+
+/*
+ * uthread_getspecific - Get the value of a key in the running thread
+ * @key: Key created with uthread_key_create()
+ *
+ * Return: Value of @key in the running thread, NULL if it was not set or if
+ * @key is invalid
+ */
+void *uthread_getspecific(uthread_key_t key);
+
+/*
+ * uthread_setspecific - Set the value of a key in the running thread
+ * @key: Key created with uthread_key_create()
+ * @value: New value of @key
+ *
+ * Return: 0 in case of success, -1 if @key is invalid or in case of failure
+ * (e.g., memory allocation)
+ */
+int uthread_setspecific(uthread_key_t key, const void *value);
+
+/* Size of the chunks the arena allocator takes from malloc() */
+#define UTHREAD_ARENA_CHUNK_SIZE	16384
+
+/*
+ * uthread_arena_alloc - Allocate memory from the arena of the running thread
+ * @size: Size of the allocation (in bytes)
+ *
+ * Bump-allocate @size bytes, aligned for any type, from an arena owned by the
+ * running thread. Allocations cannot be freed one by one: the whole arena is
+ * released with uthread_arena_reset(), e.g., at the end of a request, and when
+ * the thread exits. This is cheaper than malloc() for many small short-lived
+ * allocations, and safe with preemption enabled: the arena is only touched by
+ * its thread, and malloc() is called with preemption disabled when a new chunk
+ * of UTHREAD_ARENA_CHUNK_SIZE bytes is needed.
+ *
+ * Tasks (see task.h) share the arena of the thread running them.
+ *
+ * Return: Pointer to the allocated memory, NULL if @size is 0 or in case of
+ * failure (e.g., memory allocation, called outside of uthread_run())
+ */
+void *uthread_arena_alloc(size_t size);
+
+/*
+ * uthread_arena_reset - Release the arena of the running thread
+ *
+ * Free all the memory given by uthread_arena_alloc() to the running thread at
+ * once. One chunk is kept to serve the next allocations without malloc().
+ */
+void uthread_arena_reset(void);
+
+/*
+ * uthread_thread_stats_t - Runtime statistics of a thread
+ * @cpu_ns: Time spent running (in nanoseconds). The library runs on a single
+ *	kernel thread, so this includes the time the process itself was not
+ *	scheduled by the kernel.
+ * @ready_ns: Time spent ready to run, waiting for the processor
+ * @blocked_ns: Time spent blocked (e.g., on a semaphore)
+ * @sem_wait_ns: Time spent in sem_down() waiting for the semaphore, from the
+ *	call until the thread runs again
+ * @voluntary_switches: Number of times the thread gave the processor away,
+ *	by yielding, blocking or exiting
+ * @involuntary_switches: Number of times the thread was preempted
+ */
+typedef struct uthread_thread_stats
+{
+	uint64_t cpu_ns;
+	uint64_t ready_ns;
+	uint64_t blocked_ns;
+	uint64_t sem_wait_ns;
+	uint64_t voluntary_switches;
+	uint64_t involuntary_switches;
+} uthread_thread_stats_t;
+
+/*
+ * uthread_stack_stats_t - Stack usage of a thread
+ * @size: Size of the stack (in bytes)
+ * @used: Bytes of stack in use, down to the current stack pointer of the thread
+ * @high_water: Deepest use of the stack seen (in bytes). Exact to the page for
+ *	stacks of the UTHREAD_STACK_LAZY mode, where untouched pages are never
+ *	resident; otherwise the deepest stack pointer seen when the stack was
+ *	shrunk or its statistics read.
+ * @resident: Bytes of the stack backed by physical memory
+ * @released: Resident bytes given back to the kernel by the stack releases
+ *	so far
+ */
+typedef struct uthread_stack_stats
+{
+	size_t size;
+	size_t used;
+	size_t high_water;
+	size_t resident;
+	size_t released;
+} uthread_stack_stats_t;
+
+/*
+ * uthread_stats_t - Scheduler-wide statistics
+ * @threads_created: Number of threads created
+ * @threads_exited: Number of threads that exited
+ * @context_switches: Number of switches from one thread to another
+ * @preemptions: Number of preemptions delivered by the timer
+ * @runqueue_samples: Number of samples of the run-queue length, taken at
+ *	every scheduling decision
+ * @runqueue_total: Sum of the sampled run-queue lengths, the average length
+ *	being @runqueue_total / @runqueue_samples
+ * @runqueue_max: Largest sampled run-queue length
+ *
+ * Statistics accumulate over all the calls to uthread_run().
+ */
+typedef struct uthread_stats
+{
+	uint64_t threads_created;
+	uint64_t threads_exited;
+	uint64_t context_switches;
+	uint64_t preemptions;
+	uint64_t runqueue_samples;
+	uint64_t runqueue_total;
+	uint64_t runqueue_max;
+} uthread_stats_t;
+
+/*
+ * uthread_get_thread_stats - Get the runtime statistics of a thread
+ * @thread: Thread handle, or NULL for the running thread
+ * @stats: Address where the statistics are received
+ *
+ * Times include the current period of @thread, up to the call.
+ *
+ * Return: 0 in case of success, -1 if @stats is NULL or if there is no
+ * running thread.
+ */
+int uthread_get_thread_stats(uthread_t thread, uthread_thread_stats_t *stats);
+
+/*
+ * uthread_get_stack_stats - Get the stack usage of a thread
+ * @thread: Thread handle, or NULL for the running thread
+ * @stats: Address where the statistics are received
+ *
+ * Return: 0 in case of success, -1 if @stats is NULL, if there is no running
+ * thread, or if the stack of @thread is not known (e.g., the idle thread)
+ */
+int uthread_get_stack_stats(uthread_t thread, uthread_stack_stats_t *stats);
+
+/*
+ * uthread_stats - Get the scheduler-wide statistics
+ * @stats: Address where the statistics are received
+ *
+ * Return: 0 in case of success, -1 if @stats is NULL
+ */
+int uthread_stats(uthread_stats_t *stats);
+
+/*
+ * uthread_trace_dump - Write the scheduler trace to a file
+ * @path: Path of the file to write
+ *
+ * When the library is built with `make TRACE=1`, the scheduler records its
+ * events (thread creation, context switch, block, unblock, preemption, exit)
+ * in a ring buffer that keeps the most recent ones. This function writes them
+ * to @path in the Chrome trace event JSON format, which can be opened with
+ * Perfetto (ui.perfetto.dev) or chrome://tracing. Every thread appears as its
+ * own track, with slices showing when it was running.
+ *
+ * Return: 0 in case of success, -1 if tracing was not built in or in case of
+ * failure (e.g., memory allocation, file creation).
+ */
+int uthread_trace_dump(const char *path);
+
 #endif /* _THREAD_H */
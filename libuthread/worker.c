@@ -0,0 +1,85 @@
+#define _GNU_SOURCE
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "private.h"
+#include "uthread.h"
+
+/* Largest node number accepted, as the node mask is a single word */
+#define WORKER_MAX_NODE ((int)(8 * sizeof(unsigned long)) - 1)
+
+/* Placement of the worker, -1 when not set */
+static int worker_cpu = -1;
+static int worker_node = -1;
+
+/* Affinity of the worker before it was pinned */
+static cpu_set_t saved_affinity;
+static bool pinned;
+
+int uthread_set_worker_placement(int cpu, int node)
+{
+	if (cpu < -1 || cpu >= CPU_SETSIZE || node < -1 || node > WORKER_MAX_NODE)
+	{
+		return -1;
+	}
+
+	worker_cpu = cpu;
+	worker_node = node;
+	return 0;
+}
+
+int worker_start(void)
+{
+	cpu_set_t set;
+
+	if (worker_cpu < 0)
+	{
+		return 0;
+	}
+
+	if (sched_getaffinity(0, sizeof(saved_affinity), &saved_affinity) != 0)
+	{
+		return -1;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(worker_cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) != 0)
+	{
+		return -1;
+	}
+
+	pinned = true;
+	return 0;
+}
+
+void worker_stop(void)
+{
+	if (pinned)
+	{
+		sched_setaffinity(0, sizeof(saved_affinity), &saved_affinity);
+		pinned = false;
+	}
+}
+
+void worker_bind(void *addr, size_t len)
+{
+	unsigned long nodemask;
+
+	if (worker_node < 0)
+	{
+		return;
+	}
+
+	/*
+	 * Best effort, the memory stays usable if the policy cannot be set.
+	 * The kernel only reads @maxnode - 1 bits of the mask.
+	 */
+	nodemask = 1UL << worker_node;
+	syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &nodemask,
+		WORKER_MAX_NODE + 2, 0);
+}